@@ -0,0 +1,79 @@
+#ifndef __MOS6502_CACHE__
+#define __MOS6502_CACHE__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MOS6502_CACHE_DIRECTORY ".mos6502-cache"
+#define MOS6502_CACHE_SEED 0xCBF29CE484222325ULL
+#define MOS6502_CACHE_MAX_DEPTH 32
+
+typedef enum {
+  MOS6502_CACHE_WRITE = 1,
+  MOS6502_CACHE_LABEL,
+  MOS6502_CACHE_REFERENCE,
+  MOS6502_CACHE_ORIGIN,
+  MOS6502_CACHE_BANK,
+  MOS6502_CACHE_WINDOW,
+  MOS6502_CACHE_MACRO,
+  MOS6502_CACHE_END,
+} MOS6502_CacheOpKind;
+
+/*
+ * One decoded step of a fragment. Names, bodies and bytes point into the
+ * loaded fragment, which stays valid until mos6502_cache_close.
+ */
+typedef struct {
+  uint8_t kind;
+  uint8_t type;
+  uint16_t address;
+  uint16_t size;
+  uint16_t control;
+  uint16_t bank;
+  const uint8_t *bytes;
+  size_t count;
+  const char *name;
+  size_t name_length;
+  const char *body;
+  size_t body_length;
+} MOS6502_CacheOp;
+
+/*
+ * A fragment is everything an included file did to the assembler, in order:
+ * bytes written, labels, references left for the linker, origin and bank
+ * changes and macro definitions, plus every file it pulled in with the hash
+ * of its contents. Fragments live in MOS6502_CACHE (default
+ * .mos6502-cache), one file per key; the key covers the file's path and
+ * contents and the assembler state it was included in.
+ */
+uint64_t mos6502_cache_hash(const uint64_t, const void *, const size_t);
+
+int mos6502_cache_begin(const uint64_t);
+
+int mos6502_cache_end(const uint16_t);
+
+void mos6502_cache_depend(const char *, const uint64_t);
+
+void mos6502_cache_write(const uint16_t, const uint8_t);
+
+void mos6502_cache_label(const uint16_t, const char *, const size_t);
+
+void mos6502_cache_reference(const uint8_t, const uint16_t, const char *,
+                             const size_t);
+
+void mos6502_cache_origin(const uint16_t);
+
+void mos6502_cache_bank(const uint16_t);
+
+void mos6502_cache_window(const uint16_t, const uint16_t, const uint16_t);
+
+void mos6502_cache_macro(const char *, const size_t, const char *,
+                         const size_t);
+
+int mos6502_cache_lookup(const uint64_t, const uint8_t **, size_t *);
+
+int mos6502_cache_next(const uint8_t **, const uint8_t *, MOS6502_CacheOp *);
+
+void mos6502_cache_close(void);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef __MOS6502__
 #define __MOS6502__
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -21,6 +22,25 @@
 #define MOS6502_VEC_RESET 0xFFFC
 #define MOS6502_VEC_IRQ 0xFFFE
 
+#define MOS6502_PAGE_SIZE 0x100
+#define MOS6502_PAGE_COUNT (MOS6502_BUS_SIZE / MOS6502_PAGE_SIZE)
+
+#define MOS6502_TRAP_EXECUTE 0x01
+#define MOS6502_TRAP_READ 0x02
+#define MOS6502_TRAP_WRITE 0x04
+
+#define MOS6502_PAGE_PORT 0x08
+#define MOS6502_PAGE_BANK 0x10
+
+#define MOS6502_MAX_TRAPS 32
+
+#define MOS6502_MAX_PORTS 4
+#define MOS6502_PORT_QUEUE_SIZE 16
+
+#define MOS6502_MAX_WINDOWS 4
+#define MOS6502_WINDOW_8K 0x2000
+#define MOS6502_WINDOW_16K 0x4000
+
 typedef enum {
   MOS6502_LDX_IMMEDIATE_MODE = 0xA2,
   MOS6502_LDA_ABSOLUTE_X_MODE = 0xBD,
@@ -29,23 +49,115 @@ typedef enum {
   MOS6502_INX_IMPLIED_MODE = 0xE8,
   MOS6502_JMP_ABSOLUTE_MODE = 0x4C,
   MOS6502_BRK_IMPLIED_MODE = 0x00,
+  MOS6502_ADC_IMMEDIATE_MODE = 0x69,
+  MOS6502_SBC_IMMEDIATE_MODE = 0xE9,
+  MOS6502_CLC_IMPLIED_MODE = 0x18,
+  MOS6502_SEC_IMPLIED_MODE = 0x38,
+  MOS6502_CLD_IMPLIED_MODE = 0xD8,
+  MOS6502_SED_IMPLIED_MODE = 0xF8,
 } MOS6502_Opcode;
 
+typedef enum {
+  MOS6502_STATE_RUNNING = 0,
+  MOS6502_STATE_PAUSED,
+  MOS6502_STATE_WAITING,
+} MOS6502_State;
+
+typedef struct MOS6502 MOS6502;
+
+/*
+ * Called when an access hits a trapped address. Returning non-zero pauses the
+ * CPU, which then stays put until mos6502_resume is called.
+ */
+typedef int (*mos6502_trap_handler)(MOS6502 *, const uint8_t, const uint16_t,
+                                    void *);
+
 typedef struct {
-  uint8_t BUS[MOS6502_BUS_SIZE];
+  uint16_t address;
+  uint8_t kinds;
+} MOS6502_Trap;
+
+typedef struct {
+  uint16_t address;
+  uint8_t head;
+  uint8_t count;
+  uint8_t queue[MOS6502_PORT_QUEUE_SIZE];
+} MOS6502_Port;
+
+/*
+ * A slice of the address space showing one bank of IMAGE. Every window has
+ * the same size and banks are numbered across the whole image, bank n being
+ * the n-th slice of that size, so two windows on the same bank show the same
+ * bytes.
+ */
+typedef struct {
+  uint16_t base;
+  uint16_t size;
+  uint16_t control;
+  uint16_t bank;
+} MOS6502_Window;
+
+typedef enum {
+  MOS6502_EVENT_PORT = 1,
+  MOS6502_EVENT_IRQ,
+  MOS6502_EVENT_NMI,
+} MOS6502_EventKind;
+
+typedef struct {
+  uint64_t cycle;
+  uint16_t address;
+  uint8_t kind;
+  uint8_t value;
+} MOS6502_Event;
+
+/*
+ * Registers and run state come first so a scheduler sweeping many instances
+ * only touches their first cache line; the bus stays at the end.
+ */
+struct MOS6502 {
   uint16_t PC;
   uint8_t A;
   uint8_t X;
   uint8_t Y;
   uint8_t P;
   uint8_t SP;
-} MOS6502;
+  uint8_t STATE;
+  uint8_t TRAPPED;
+  /* Set when a port read found its queue empty: the instruction is rolled
+   * back and only retried once mos6502_feed brings input, even if a
+   * watchpoint on the same access paused the CPU. */
+  uint8_t STARVED;
+  uint64_t CYCLES;
+  /* Union of the trap kinds and port bits set on each page, so plain pages
+   * skip the lookups in TRAPS and PORTS entirely. */
+  uint8_t PAGE_FLAGS[MOS6502_PAGE_COUNT];
+  /* Where each page of the address space lives: BUS by default, or a slice
+   * of IMAGE while a bank is mapped over it. */
+  uint8_t *PAGES[MOS6502_PAGE_COUNT];
+  MOS6502_Trap TRAPS[MOS6502_MAX_TRAPS];
+  uint8_t TRAP_COUNT;
+  mos6502_trap_handler TRAP_HANDLER;
+  void *TRAP_CONTEXT;
+  MOS6502_Port PORTS[MOS6502_MAX_PORTS];
+  uint8_t PORT_COUNT;
+  MOS6502_Window WINDOWS[MOS6502_MAX_WINDOWS];
+  uint8_t WINDOW_COUNT;
+  uint8_t *IMAGE;
+  size_t IMAGE_SIZE;
+  /* Record/replay logs, see replay.h. REPLAY_EVENT is the next one due. */
+  FILE *RECORD;
+  uint64_t RECORD_CYCLE;
+  FILE *REPLAY;
+  uint64_t REPLAY_CYCLE;
+  MOS6502_Event REPLAY_EVENT;
+  uint8_t BUS[MOS6502_BUS_SIZE];
+};
 
 MOS6502 *mos6502_construct(void);
 
 void mos6502_destruct(MOS6502 *);
 
-uint8_t mos6502_read(const MOS6502 *, const uint16_t);
+uint8_t mos6502_read(MOS6502 *, const uint16_t);
 
 void mos6502_write(MOS6502 *, const uint16_t, const uint8_t);
 
@@ -61,12 +173,43 @@ uint8_t mos6502_pop(MOS6502 *);
 
 void mos6502_execute(MOS6502 *);
 
+int mos6502_irq(MOS6502 *);
+
+void mos6502_nmi(MOS6502 *);
+
+uint8_t mos6502_run(MOS6502 *, const uint64_t);
+
+int mos6502_add_trap(MOS6502 *, const uint16_t, const uint8_t);
+
+void mos6502_remove_trap(MOS6502 *, const uint16_t, const uint8_t);
+
+void mos6502_set_trap_handler(MOS6502 *, mos6502_trap_handler, void *);
+
+void mos6502_resume(MOS6502 *);
+
+int mos6502_add_port(MOS6502 *, const uint16_t);
+
+int mos6502_feed(MOS6502 *, const uint16_t, const uint8_t);
+
+void mos6502_set_image(MOS6502 *, uint8_t *, const size_t);
+
+int mos6502_add_window(MOS6502 *, const uint16_t, const uint16_t,
+                       const uint16_t);
+
+int mos6502_find_window(const MOS6502 *, const uint16_t);
+
+int mos6502_select_bank(MOS6502 *, const uint8_t, const uint16_t);
+
 void mos6502_dump(const MOS6502 *, FILE *);
 
 void mos6502_dump_status(const MOS6502 *, FILE *);
 
 void mos6502_update_z_n_status(MOS6502 *, const uint8_t);
 
+void mos6502_adc(MOS6502 *, const uint8_t);
+
+void mos6502_sbc(MOS6502 *, const uint8_t);
+
 void LDX_IMMEDIATE_MODE(MOS6502 *);
 
 void LDA_ABSOLUTE_X_MODE(MOS6502 *);
@@ -81,4 +224,16 @@ void JMP_ABSOLUTE_MODE(MOS6502 *);
 
 void BRK_IMPLIED_MODE(MOS6502 *);
 
+void ADC_IMMEDIATE_MODE(MOS6502 *);
+
+void SBC_IMMEDIATE_MODE(MOS6502 *);
+
+void CLC_IMPLIED_MODE(MOS6502 *);
+
+void SEC_IMPLIED_MODE(MOS6502 *);
+
+void CLD_IMPLIED_MODE(MOS6502 *);
+
+void SED_IMPLIED_MODE(MOS6502 *);
+
 #endif
@@ -0,0 +1,29 @@
+#ifndef __MOS6502_REPLAY__
+#define __MOS6502_REPLAY__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mos6502.h"
+
+/*
+ * A snapshot holds the registers, the bus and the banking state. Restoring it
+ * and replaying the event log recorded from that point reproduces the run.
+ * Both formats use the host byte order.
+ */
+int mos6502_snapshot(const MOS6502 *, FILE *);
+
+int mos6502_restore(MOS6502 *, FILE *);
+
+void mos6502_record(MOS6502 *, FILE *);
+
+void mos6502_replay(MOS6502 *, FILE *);
+
+void mos6502_record_event(MOS6502 *, const uint8_t, const uint16_t,
+                          const uint8_t);
+
+int mos6502_replay_port(MOS6502 *, const uint16_t, uint8_t *);
+
+uint8_t mos6502_replay_interrupt(MOS6502 *);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef __MOS6502_SCHEDULER__
+#define __MOS6502_SCHEDULER__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mos6502.h"
+
+typedef struct {
+  MOS6502 **CPUS;
+  size_t COUNT;
+  size_t CAPACITY;
+  uint64_t QUANTUM;
+} MOS6502_Scheduler;
+
+MOS6502_Scheduler *mos6502_scheduler_construct(const uint64_t);
+
+void mos6502_scheduler_destruct(MOS6502_Scheduler *);
+
+int mos6502_scheduler_add(MOS6502_Scheduler *, MOS6502 *);
+
+size_t mos6502_scheduler_run(MOS6502_Scheduler *);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef __MOS6502_TRANSLATOR__
+#define __MOS6502_TRANSLATOR__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mos6502.h"
+
+/*
+ * Emits a C translation unit with NAME_load, which copies the address space
+ * and any banked image into a freshly constructed CPU, and NAME_run, a
+ * drop-in replacement for mos6502_run in which the code reachable from the
+ * entry points is compiled into straight-line blocks. Code in bank windows
+ * is left to the interpreter.
+ */
+int mos6502_translate(const MOS6502 *, const uint16_t *, const size_t,
+                      const char *, FILE *);
+
+#endif
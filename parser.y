@@ -4,29 +4,44 @@
 #include <string.h>
 #include <stdint.h>
 
+#include "cache.h"
 #include "mos6502.h"
 #include "parser.tab.h"
+#include "translator.h"
 
 extern FILE *yyin;
 extern int yylex();
 extern int yylineno;
 
+extern void lexer_define_macro(const char *, const size_t, const char *, const size_t);
+
 uint16_t current_address = 0x0000;
 
+int current_bank = -1;
+
+/* Set by .BANK until the bank lands in a window: right away, at the next
+ * .ORG or at the next byte emitted, whichever comes first. */
+int bank_pending = 0;
+
 extern MOS6502 *CPU;
 
+extern FILE *AOT;
+extern char AOT_NAME[];
+
 #define MAX_TOKENS 1024
 
 typedef enum {
     TOKEN_REF_ABS_ADDR,
     TOKEN_REF_REL_OFFSET,
     TOKEN_LABEL,
+    TOKEN_JUMP_TARGET,
 } TokenType;
 
 typedef struct {
     TokenType type;
     uint16_t address;
-    char *buffer;
+    int bank;
+    Slice buffer;
 } Token;
 
 Token token_table[MAX_TOKENS];
@@ -35,34 +50,35 @@ size_t token_count = 0;
 Token reference_table[MAX_TOKENS];
 size_t reference_count = 0;
 
-void add_token(const char* buffer, uint16_t address) {
+int slice_equals(const Slice left, const Slice right) {
+    return left.length == right.length && memcmp(left.buffer, right.buffer, left.length) == 0;
+}
+
+void add_token(const Slice buffer, uint16_t address) {
     if (MAX_TOKENS <= token_count) {
         fprintf(stderr, "Yacc: Max %d tokens allowed. Exiting.\n", MAX_TOKENS);
         exit(1);
     }
 
     for (size_t index = 0; index < token_count; ++index) {
-        if (strcmp(token_table[index].buffer, buffer) == 0) {
-            fprintf(stderr, "Yacc: Duplicate token '%s' defined at 0x%04X. Already defined at 0x%04X. Exiting.\n",
-                            buffer, address, token_table[index].address);
+        if (slice_equals(token_table[index].buffer, buffer)) {
+            fprintf(stderr, "Yacc: Duplicate token '%.*s' defined at 0x%04X. Already defined at 0x%04X. Exiting.\n",
+                            (int)buffer.length, buffer.buffer, address, token_table[index].address);
             exit(1);
         }
     }
 
-    token_table[token_count].buffer = strdup(buffer);
-    if (token_table[token_count].buffer == NULL) {
-        perror("Yacc: Failed to allocate memory for token buffer");
-        exit(1);
-    }
-
+    token_table[token_count].buffer = buffer;
     token_table[token_count].address = address;
     token_table[token_count].type = TOKEN_LABEL;
     ++token_count;
+
+    mos6502_cache_label(address, buffer.buffer, buffer.length);
 }
 
-int get_token_address(const char* buffer, uint16_t* address) {
+int get_token_address(const Slice buffer, uint16_t* address) {
     for (size_t index = 0; index < token_count; ++index) {
-        if (strcmp(token_table[index].buffer, buffer) == 0) {
+        if (slice_equals(token_table[index].buffer, buffer)) {
             *address = token_table[index].address;
             return 1;
         }
@@ -70,7 +86,16 @@ int get_token_address(const char* buffer, uint16_t* address) {
     return 0;
 }
 
-void add_forward_ref(uint16_t address, const char* buffer, TokenType type) {
+void mark_jump_target(const Slice buffer) {
+    for (size_t index = 0; index < token_count; ++index) {
+        if (slice_equals(token_table[index].buffer, buffer)) {
+            token_table[index].type = TOKEN_JUMP_TARGET;
+            return;
+        }
+    }
+}
+
+void add_forward_ref(uint16_t address, const Slice buffer, TokenType type) {
     if (reference_count >= MAX_TOKENS) {
         fprintf(stderr, "Yacc: Max %d forward references allowed. Exiting.\n", MAX_TOKENS);
         exit(1);
@@ -78,28 +103,172 @@ void add_forward_ref(uint16_t address, const char* buffer, TokenType type) {
 
     reference_table[reference_count].address = address;
 
-    reference_table[reference_count].buffer = strdup(buffer);
-    if (reference_table[reference_count].buffer == NULL) {
-        perror("Yacc: Failed to allocate memory for reference buffer");
+    reference_table[reference_count].buffer = buffer;
+    reference_table[reference_count].type = type;
+    reference_table[reference_count].bank = current_bank;
+    ++reference_count;
+
+    mos6502_cache_reference(type, address, buffer.buffer, buffer.length);
+}
+
+void select_bank(uint16_t address, int bank);
+
+/*
+ * Everything an included file does to the image goes through emit and the
+ * directive helpers below, so it can be recorded into its cache fragment and
+ * replayed from there.
+ */
+void emit(uint16_t address, uint8_t value) {
+    if (bank_pending) {
+        select_bank(address, current_bank);
+    }
+
+    mos6502_write(CPU, address, value);
+    mos6502_cache_write(address, value);
+}
+
+void select_bank(uint16_t address, int bank) {
+    if (bank < 0) {
+        return;
+    }
+
+    const int window = mos6502_find_window(CPU, address);
+
+    if (window < 0) {
+        if (bank_pending) {
+            fprintf(stderr, "Yacc: Bank %d selected at line %d but no .WINDOW covers 0x%04X. Exiting.\n",
+                    bank, yylineno, address);
+            exit(1);
+        }
+        return;
+    }
+
+    bank_pending = 0;
+
+    if (CPU->WINDOWS[window].bank == bank) {
+        return;
+    }
+
+    if (!mos6502_select_bank(CPU, window, bank)) {
+        fprintf(stderr, "Yacc: Bank %d cannot be mapped at 0x%04X. Exiting.\n", bank, address);
         exit(1);
     }
+}
 
-    reference_table[reference_count].type = type;
-    ++reference_count;
+void set_origin(uint16_t address) {
+    current_address = address;
+    select_bank(current_address, current_bank);
+
+    mos6502_cache_origin(address);
+}
+
+void set_bank(int bank) {
+    current_bank = bank;
+    bank_pending = 1;
+
+    if (0 <= mos6502_find_window(CPU, current_address)) {
+        select_bank(current_address, current_bank);
+    }
+
+    mos6502_cache_bank(bank);
+}
+
+void add_window(uint16_t base, uint16_t size, uint16_t control) {
+    if (!mos6502_add_window(CPU, base, size, control)) {
+        fprintf(stderr, "Yacc: Invalid bank window at line %d. Exiting.\n", yylineno);
+        exit(1);
+    }
+
+    if (0 <= mos6502_find_window(CPU, current_address)) {
+        select_bank(current_address, current_bank);
+    }
+
+    mos6502_cache_window(base, size, control);
+}
+
+/*
+ * Replays the fragment stored under key, if it is still valid, as if the
+ * included file had been assembled again. Returns 0 on a miss.
+ */
+int include_cached(uint64_t key) {
+    const uint8_t *ops = NULL;
+    size_t length = 0;
+
+    if (!mos6502_cache_lookup(key, &ops, &length)) {
+        return 0;
+    }
+
+    const uint8_t *end = ops + length;
+    MOS6502_CacheOp op;
+
+    while (mos6502_cache_next(&ops, end, &op)) {
+        const Slice name = {op.name, op.name_length};
+
+        switch (op.kind) {
+        case MOS6502_CACHE_WRITE:
+            for (size_t index = 0; index < op.count; ++index) {
+                emit(op.address + index, op.bytes[index]);
+            }
+            break;
+        case MOS6502_CACHE_LABEL:
+            add_token(name, op.address);
+            break;
+        case MOS6502_CACHE_REFERENCE:
+            add_forward_ref(op.address, name, (TokenType)op.type);
+            break;
+        case MOS6502_CACHE_ORIGIN:
+            set_origin(op.address);
+            break;
+        case MOS6502_CACHE_BANK:
+            set_bank(op.bank);
+            break;
+        case MOS6502_CACHE_WINDOW:
+            add_window(op.address, op.size, op.control);
+            break;
+        case MOS6502_CACHE_MACRO:
+            lexer_define_macro(op.name, op.name_length, op.body, op.body_length);
+            break;
+        case MOS6502_CACHE_END:
+            current_address = op.address;
+            return 1;
+        }
+    }
+
+    /* Unreachable: mos6502_cache_lookup only hands out fragments that decode
+     * up to their END. */
+    return 0;
 }
 
 void resolve_forward_references() {
+    uint16_t banks[MOS6502_MAX_WINDOWS];
+
+    bank_pending = 0;
+
+    for (uint8_t index = 0; index < CPU->WINDOW_COUNT; ++index) {
+        banks[index] = CPU->WINDOWS[index].bank;
+    }
+
     fprintf(stdout, "Yacc: Resolving forward references...\n");
     for (size_t index = 0; index < reference_count; ++index) {
         const Token token = reference_table[index];
 
+        select_bank(token.address, token.bank);
+
         uint16_t target_address;
 
         if (!get_token_address(token.buffer, &target_address)) {
-            fprintf(stderr, "Yacc: Undefined token '%s' referenced at 0x%04X. Exiting.\n", token.buffer, token.address);
+            fprintf(stderr, "Yacc: Undefined token '%.*s' referenced at 0x%04X. Exiting.\n",
+                    (int)token.buffer.length, token.buffer.buffer, token.address);
             exit(1);
         }
 
+        const uint16_t opcode_address = token.address - 1;
+
+        if (token.type == TOKEN_REF_REL_OFFSET ||
+            CPU->PAGES[opcode_address >> 8][opcode_address & 0xFF] == MOS6502_JMP_ABSOLUTE_MODE) {
+            mark_jump_target(token.buffer);
+        }
+
         if (token.type == TOKEN_REF_ABS_ADDR) {
             mos6502_write(CPU, token.address, (target_address & 0xFF));
             mos6502_write(CPU, token.address + 1, ((target_address >> 8) & 0xFF));
@@ -107,48 +276,91 @@ void resolve_forward_references() {
             int16_t offset = target_address - (token.address + 1);
 
             if (offset < -128 || offset > 127) {
-                fprintf(stderr, "Yacc: Branch target '%s' (0x%04X) is out of range for relative branch from 0x%04X (offset %d). Exiting.\n",
-                        token.buffer, target_address, token.address - 1, offset);
+                fprintf(stderr, "Yacc: Branch target '%.*s' (0x%04X) is out of range for relative branch from 0x%04X (offset %d). Exiting.\n",
+                        (int)token.buffer.length, token.buffer.buffer, target_address, token.address - 1, offset);
                 exit(1);
             }
             mos6502_write(CPU, token.address, (int8_t)(offset & 0xFF));
         }
     }
+
+    for (uint8_t index = 0; index < CPU->WINDOW_COUNT; ++index) {
+        select_bank(CPU->WINDOWS[index].base, banks[index]);
+    }
     fprintf(stdout, "Yacc: Forward references resolved.\n");
 }
 
-void cleanup_tables() {
-    for (size_t i = 0; i < token_count; ++i) {
-        free(token_table[i].buffer);
-        token_table[i].buffer = NULL;
+/*
+ * Translates from the reset vector, or the first label when the program sets
+ * none, and from every label a JMP or BEQ lands on. Data labels are left out
+ * so their bytes are never decoded as instructions.
+ */
+void translate_program() {
+    uint16_t entries[MAX_TOKENS + 1];
+    size_t entry_count = 0;
+
+    const uint16_t reset = CPU->PAGES[MOS6502_VEC_RESET >> 8][MOS6502_VEC_RESET & 0xFF] |
+                           (CPU->PAGES[MOS6502_VEC_RESET >> 8][(MOS6502_VEC_RESET + 1) & 0xFF] << 8);
+
+    if (0 != reset) {
+        entries[entry_count++] = reset;
+    } else if (0 < token_count) {
+        entries[entry_count++] = token_table[0].address;
     }
-    for (size_t i = 0; i < reference_count; ++i) {
-        free(reference_table[i].buffer);
-        reference_table[i].buffer = NULL;
+
+    for (size_t index = 0; index < token_count; ++index) {
+        if (token_table[index].type == TOKEN_JUMP_TARGET) {
+            entries[entry_count++] = token_table[index].address;
+        }
+    }
+
+    fprintf(stdout, "Yacc: Translating %zu entry points to C...\n", entry_count);
+
+    if (!mos6502_translate(CPU, entries, entry_count, AOT_NAME, AOT)) {
+        fprintf(stderr, "Yacc: Translation failed. Exiting.\n");
+        exit(1);
     }
+
+    fprintf(stdout, "Yacc: Translation finished.\n");
+}
+
+void cleanup_tables() {
+    token_count = 0;
+    reference_count = 0;
 }
 
 %}
 
+%code requires {
+#include <stddef.h>
+
+/* Label and string tokens point into the lexer's source buffer. */
+typedef struct {
+    const char *buffer;
+    size_t length;
+} Slice;
+}
+
 %union {
     int ival;
-    char* sval;
+    Slice slice;
 }
 
 %token NEWLINE
 %token <ival> HEX_VALUE DEC_VALUE
-%token <sval> STRING_LITERAL LABEL_DEF LABEL_REF
+%token <slice> STRING_LITERAL LABEL_DEF LABEL_REF
 
 %token LDX_OP LDA_OP BEQ_OP STA_OP INX_OP JMP_OP BRK_OP
+%token ADC_OP SBC_OP CLC_OP SEC_OP CLD_OP SED_OP
 
-%token ORG_DIR BYTE_DIR
+%token ORG_DIR BYTE_DIR BANK_DIR WINDOW_DIR
 
 %token HASH
 %token COMMA
 %token REG_X
 
 %type <ival> address_operand immediate_operand
-%type <sval> buffer
+%type <slice> buffer
 
 %%
 
@@ -157,20 +369,24 @@ program:
     {
         resolve_forward_references();
 
-        printf("Yacc: MOS6502 execution started.\n");
+        if (AOT != NULL) {
+            translate_program();
+        } else {
+            printf("Yacc: MOS6502 execution started.\n");
 
-        if (CPU == NULL) {
-            fprintf(stderr, "Yacc: CPU not initialized. Exiting.\n");
-            exit(1);
-        }
+            if (CPU == NULL) {
+                fprintf(stderr, "Yacc: CPU not initialized. Exiting.\n");
+                exit(1);
+            }
 
-        CPU->PC = current_address;
+            CPU->PC = current_address;
 
-        mos6502_execute(CPU);
+            mos6502_execute(CPU);
 
-        mos6502_dump(CPU, stdout);
+            mos6502_dump(CPU, stdout);
 
-        printf("Yacc: MOS6502 execution finished.\n");
+            printf("Yacc: MOS6502 execution finished.\n");
+        }
 
         cleanup_tables();
     }
@@ -193,54 +409,81 @@ line:
 token_definition:
     LABEL_DEF {
         add_token($1, current_address);
-        free($1);
     }
 ;
 
 instruction:
     LDX_OP HASH immediate_operand {
-        mos6502_write(CPU, current_address++, MOS6502_LDX_IMMEDIATE_MODE);
-        mos6502_write(CPU, current_address++, $3);
+        emit(current_address++, MOS6502_LDX_IMMEDIATE_MODE);
+        emit(current_address++, $3);
     }
     | LDA_OP buffer COMMA REG_X {
-        mos6502_write(CPU, current_address++, MOS6502_LDA_ABSOLUTE_X_MODE);
+        emit(current_address++, MOS6502_LDA_ABSOLUTE_X_MODE);
         add_forward_ref(current_address, $2, TOKEN_REF_ABS_ADDR);
         current_address += 2;
-        free($2);
     }
     | BEQ_OP buffer {
-        mos6502_write(CPU, current_address++, MOS6502_BEQ_RELATIVE_MODE);
+        emit(current_address++, MOS6502_BEQ_RELATIVE_MODE);
         add_forward_ref(current_address, $2, TOKEN_REF_REL_OFFSET);
         current_address++;
-        free($2);
     }
     | STA_OP address_operand {
-        mos6502_write(CPU, current_address++, MOS6502_STA_ABSOLUTE_MODE);
-        mos6502_write(CPU, current_address++, ($2 & 0xFF));
-        mos6502_write(CPU, current_address++, (($2 >> 8) & 0xFF));
+        emit(current_address++, MOS6502_STA_ABSOLUTE_MODE);
+        emit(current_address++, ($2 & 0xFF));
+        emit(current_address++, (($2 >> 8) & 0xFF));
+    }
+    | STA_OP buffer {
+        emit(current_address++, MOS6502_STA_ABSOLUTE_MODE);
+        add_forward_ref(current_address, $2, TOKEN_REF_ABS_ADDR);
+        current_address += 2;
     }
     | INX_OP {
-        mos6502_write(CPU, current_address++, MOS6502_INX_IMPLIED_MODE);
+        emit(current_address++, MOS6502_INX_IMPLIED_MODE);
     }
     | JMP_OP address_operand {
-        mos6502_write(CPU, current_address++, MOS6502_JMP_ABSOLUTE_MODE);
-        mos6502_write(CPU, current_address++, ($2 & 0xFF));
-        mos6502_write(CPU, current_address++, (($2 >> 8) & 0xFF));
+        emit(current_address++, MOS6502_JMP_ABSOLUTE_MODE);
+        emit(current_address++, ($2 & 0xFF));
+        emit(current_address++, (($2 >> 8) & 0xFF));
     }
     | JMP_OP buffer {
-        mos6502_write(CPU, current_address++, MOS6502_JMP_ABSOLUTE_MODE);
+        emit(current_address++, MOS6502_JMP_ABSOLUTE_MODE);
         add_forward_ref(current_address, $2, TOKEN_REF_ABS_ADDR);
         current_address += 2;
-        free($2);
     }
     | BRK_OP {
-        mos6502_write(CPU, current_address++, MOS6502_BRK_IMPLIED_MODE);
+        emit(current_address++, MOS6502_BRK_IMPLIED_MODE);
+    }
+    | ADC_OP HASH immediate_operand {
+        emit(current_address++, MOS6502_ADC_IMMEDIATE_MODE);
+        emit(current_address++, $3);
+    }
+    | SBC_OP HASH immediate_operand {
+        emit(current_address++, MOS6502_SBC_IMMEDIATE_MODE);
+        emit(current_address++, $3);
+    }
+    | CLC_OP {
+        emit(current_address++, MOS6502_CLC_IMPLIED_MODE);
+    }
+    | SEC_OP {
+        emit(current_address++, MOS6502_SEC_IMPLIED_MODE);
+    }
+    | CLD_OP {
+        emit(current_address++, MOS6502_CLD_IMPLIED_MODE);
+    }
+    | SED_OP {
+        emit(current_address++, MOS6502_SED_IMPLIED_MODE);
     }
 ;
 
 directive:
     ORG_DIR HEX_VALUE {
-        current_address = $2;
+        set_origin($2);
+    }
+    | BANK_DIR immediate_operand {
+        set_bank($2);
+    }
+    | WINDOW_DIR HEX_VALUE COMMA HEX_VALUE COMMA HEX_VALUE {
+        add_window($2, $4, $6);
     }
     | BYTE_DIR byte_list {
     }
@@ -253,32 +496,20 @@ byte_list:
 
 byte_item:
     HEX_VALUE {
-        mos6502_write(CPU, current_address++, $1);
+        emit(current_address++, $1);
     }
     | DEC_VALUE {
-        mos6502_write(CPU, current_address++, $1);
+        emit(current_address++, $1);
     }
     | STRING_LITERAL {
-        for (size_t index = 0; index < strlen($1); ++index) {
-            mos6502_write(CPU, current_address++, $1[index]);
+        for (size_t index = 0; index < $1.length; ++index) {
+            emit(current_address++, $1.buffer[index]);
         }
-        free($1);
     }
 ;
 
 address_operand:
     HEX_VALUE { $$ = $1; }
-    | buffer {
-        uint16_t address;
-        if (!get_token_address($1, &address)) {
-             fprintf(stderr, "Yacc: Undefined label '%s' used as direct address at 0x%04X. This type of reference is not handled as a forward reference for this instruction (STA/JMP direct). Exiting.\n",
-                             $1, current_address);
-             free($1);
-             exit(1);
-        }
-        $$ = address;
-        free($1);
-    }
 ;
 
 immediate_operand:
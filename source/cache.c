@@ -0,0 +1,627 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MOS6502_CACHE_MAGIC[4] = {'M', '6', '5', 'C'};
+
+#define MOS6502_CACHE_NO_RUN SIZE_MAX
+
+typedef struct {
+  uint8_t *data;
+  size_t length;
+  size_t capacity;
+} CacheBuffer;
+
+typedef struct {
+  uint64_t key;
+  CacheBuffer ops;
+  CacheBuffer deps;
+  uint32_t dep_count;
+  /* Offset of the trailing write op, which grows while the bytes written
+   * stay contiguous. */
+  size_t run;
+  int failed;
+} CacheFragment;
+
+/* Fragments being recorded, outermost first: a nested include lands in all
+ * of them so each one can be replayed on its own. */
+static CacheFragment cache_fragments[MOS6502_CACHE_MAX_DEPTH];
+static size_t cache_depth = 0;
+
+static uint8_t **cache_loaded = NULL;
+static size_t cache_loaded_count = 0;
+static size_t cache_loaded_capacity = 0;
+
+/* FNV-1a, which can be fed in pieces by passing the previous result. */
+uint64_t mos6502_cache_hash(const uint64_t seed, const void *data,
+                            const size_t length) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  uint64_t hash = seed;
+
+  for (size_t index = 0; index < length; ++index) {
+    hash ^= bytes[index];
+    hash *= 0x100000001B3ULL;
+  }
+
+  return hash;
+}
+
+static uint16_t cache_get_u16(const uint8_t *bytes) {
+  return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+static uint64_t cache_get_u64(const uint8_t *bytes) {
+  uint64_t value = 0;
+
+  for (uint8_t index = 0; index < 8; ++index) {
+    value |= (uint64_t)bytes[index] << (index * 8);
+  }
+
+  return value;
+}
+
+static void cache_put_u64(uint8_t *bytes, const uint64_t value) {
+  for (uint8_t index = 0; index < 8; ++index) {
+    bytes[index] = (uint8_t)(value >> (index * 8));
+  }
+}
+
+static void cache_put(CacheFragment *fragment, CacheBuffer *buffer,
+                      const void *data, const size_t length) {
+  if (fragment->failed || 0 == length) {
+    return;
+  }
+
+  if (buffer->capacity < buffer->length + length) {
+    size_t capacity = (0 == buffer->capacity) ? 256 : buffer->capacity;
+
+    while (capacity < buffer->length + length) {
+      capacity *= 2;
+    }
+
+    uint8_t *grown = (uint8_t *)realloc(buffer->data, capacity);
+
+    if (NULL == grown) {
+      fprintf(stderr, "MOS6502: Cache fragment could not grow to %zu bytes\n",
+              capacity);
+      fragment->failed = 1;
+      return;
+    }
+
+    buffer->data = grown;
+    buffer->capacity = capacity;
+  }
+
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+}
+
+static void cache_record(const uint8_t *header, const size_t header_length,
+                         const char *name, const size_t name_length,
+                         const char *body, const size_t body_length) {
+  for (size_t depth = 0; depth < cache_depth; ++depth) {
+    CacheFragment *fragment = &cache_fragments[depth];
+
+    cache_put(fragment, &fragment->ops, header, header_length);
+    cache_put(fragment, &fragment->ops, name, name_length);
+    cache_put(fragment, &fragment->ops, body, body_length);
+
+    fragment->run = MOS6502_CACHE_NO_RUN;
+  }
+}
+
+static void cache_free(CacheFragment *fragment) {
+  free(fragment->ops.data);
+  free(fragment->deps.data);
+  memset(fragment, 0, sizeof(CacheFragment));
+}
+
+static const char *cache_directory(void) {
+  const char *directory = getenv("MOS6502_CACHE");
+
+  return (NULL == directory || '\0' == directory[0]) ? MOS6502_CACHE_DIRECTORY
+                                                     : directory;
+}
+
+static int cache_path(char *path, const size_t size, const uint64_t key,
+                      const char *suffix) {
+  const int length = snprintf(path, size, "%s/%016llx%s", cache_directory(),
+                              (unsigned long long)key, suffix);
+
+  return 0 < length && (size_t)length < size;
+}
+
+static int cache_hash_file(const char *path, uint64_t *hash) {
+  FILE *stream = fopen(path, "rb");
+
+  if (NULL == stream) {
+    return 0;
+  }
+
+  uint8_t chunk[4096];
+  size_t read = 0;
+
+  *hash = MOS6502_CACHE_SEED;
+
+  while (0 < (read = fread(chunk, 1, sizeof(chunk), stream))) {
+    *hash = mos6502_cache_hash(*hash, chunk, read);
+  }
+
+  const int ok = !ferror(stream);
+
+  fclose(stream);
+
+  return ok;
+}
+
+int mos6502_cache_begin(const uint64_t key) {
+  if (MOS6502_CACHE_MAX_DEPTH == cache_depth) {
+    fprintf(stderr, "MOS6502: Includes nested deeper than %d levels\n",
+            MOS6502_CACHE_MAX_DEPTH);
+    return 0;
+  }
+
+  CacheFragment *fragment = &cache_fragments[cache_depth++];
+
+  memset(fragment, 0, sizeof(CacheFragment));
+
+  fragment->key = key;
+  fragment->run = MOS6502_CACHE_NO_RUN;
+
+  return 1;
+}
+
+static int cache_store(const CacheFragment *fragment) {
+  if (0 != mkdir(cache_directory(), 0755) && EEXIST != errno) {
+    fprintf(stderr, "MOS6502: Unable to create the '%s' cache directory\n",
+            cache_directory());
+    return 0;
+  }
+
+  char temporary[4096];
+  char path[4096];
+
+  if (!cache_path(temporary, sizeof(temporary), fragment->key, ".XXXXXX") ||
+      !cache_path(path, sizeof(path), fragment->key, "")) {
+    return 0;
+  }
+
+  /* Assemblers sharing a cache may store the same fragment at once, so each
+   * writes its own uniquely named file. */
+  const int descriptor = mkstemp(temporary);
+  FILE *stream = (0 > descriptor) ? NULL : fdopen(descriptor, "wb");
+
+  if (NULL == stream) {
+    fprintf(stderr, "MOS6502: Unable to create the '%s' file\n", temporary);
+
+    if (0 <= descriptor) {
+      close(descriptor);
+      remove(temporary);
+    }
+
+    return 0;
+  }
+
+  uint8_t count[4] = {
+      (uint8_t)fragment->dep_count,
+      (uint8_t)(fragment->dep_count >> 8),
+      (uint8_t)(fragment->dep_count >> 16),
+      (uint8_t)(fragment->dep_count >> 24),
+  };
+  uint8_t length[8];
+
+  cache_put_u64(length, fragment->ops.length);
+
+  int ok = 1 == fwrite(MOS6502_CACHE_MAGIC, sizeof(MOS6502_CACHE_MAGIC), 1,
+                       stream);
+
+  ok = ok && 1 == fwrite(count, sizeof(count), 1, stream);
+  ok = ok && (0 == fragment->deps.length ||
+              1 == fwrite(fragment->deps.data, fragment->deps.length, 1,
+                          stream));
+  ok = ok && 1 == fwrite(length, sizeof(length), 1, stream);
+  ok = ok && (0 == fragment->ops.length ||
+              1 == fwrite(fragment->ops.data, fragment->ops.length, 1, stream));
+  ok = (0 == fclose(stream)) && ok;
+
+  /* Renamed into place so a concurrent or interrupted run never sees half a
+   * fragment. */
+  if (!ok || 0 != rename(temporary, path)) {
+    fprintf(stderr, "MOS6502: Unable to write the '%s' file\n", path);
+    remove(temporary);
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Records where the assembler stopped, stores the innermost fragment and
+ * stops recording it. */
+int mos6502_cache_end(const uint16_t address) {
+  if (0 == cache_depth) {
+    return 0;
+  }
+
+  CacheFragment *fragment = &cache_fragments[cache_depth - 1];
+
+  const uint8_t header[3] = {MOS6502_CACHE_END, (uint8_t)address,
+                             (uint8_t)(address >> 8)};
+
+  cache_put(fragment, &fragment->ops, header, sizeof(header));
+
+  const int ok = !fragment->failed && cache_store(fragment);
+
+  cache_free(fragment);
+  --cache_depth;
+
+  return ok;
+}
+
+void mos6502_cache_depend(const char *path, const uint64_t hash) {
+  const size_t length = strlen(path);
+  const uint8_t header[2] = {(uint8_t)length, (uint8_t)(length >> 8)};
+  uint8_t content[8];
+
+  cache_put_u64(content, hash);
+
+  for (size_t depth = 0; depth < cache_depth; ++depth) {
+    CacheFragment *fragment = &cache_fragments[depth];
+
+    if (0xFFFF < length) {
+      fragment->failed = 1;
+      continue;
+    }
+
+    cache_put(fragment, &fragment->deps, header, sizeof(header));
+    cache_put(fragment, &fragment->deps, path, length);
+    cache_put(fragment, &fragment->deps, content, sizeof(content));
+
+    ++fragment->dep_count;
+  }
+}
+
+void mos6502_cache_write(const uint16_t address, const uint8_t value) {
+  for (size_t depth = 0; depth < cache_depth; ++depth) {
+    CacheFragment *fragment = &cache_fragments[depth];
+
+    if (fragment->failed) {
+      continue;
+    }
+
+    if (MOS6502_CACHE_NO_RUN != fragment->run) {
+      const uint8_t *run = fragment->ops.data + fragment->run;
+      const uint16_t start = cache_get_u16(run + 1);
+      const uint16_t count = cache_get_u16(run + 3);
+
+      if (0xFFFF > count && (uint16_t)(start + count) == address) {
+        cache_put(fragment, &fragment->ops, &value, 1);
+
+        if (!fragment->failed) {
+          fragment->ops.data[fragment->run + 3] = (uint8_t)(count + 1);
+          fragment->ops.data[fragment->run + 4] = (uint8_t)((count + 1) >> 8);
+        }
+        continue;
+      }
+    }
+
+    const uint8_t header[6] = {
+        MOS6502_CACHE_WRITE, (uint8_t)address, (uint8_t)(address >> 8), 1, 0,
+        value,
+    };
+
+    fragment->run = fragment->ops.length;
+    cache_put(fragment, &fragment->ops, header, sizeof(header));
+  }
+}
+
+void mos6502_cache_label(const uint16_t address, const char *name,
+                         const size_t length) {
+  const uint8_t header[5] = {
+      MOS6502_CACHE_LABEL, (uint8_t)address, (uint8_t)(address >> 8),
+      (uint8_t)length,     (uint8_t)(length >> 8),
+  };
+
+  cache_record(header, sizeof(header), name, length, NULL, 0);
+}
+
+void mos6502_cache_reference(const uint8_t type, const uint16_t address,
+                             const char *name, const size_t length) {
+  const uint8_t header[6] = {
+      MOS6502_CACHE_REFERENCE, type, (uint8_t)address, (uint8_t)(address >> 8),
+      (uint8_t)length,         (uint8_t)(length >> 8),
+  };
+
+  cache_record(header, sizeof(header), name, length, NULL, 0);
+}
+
+void mos6502_cache_origin(const uint16_t address) {
+  const uint8_t header[3] = {MOS6502_CACHE_ORIGIN, (uint8_t)address,
+                             (uint8_t)(address >> 8)};
+
+  cache_record(header, sizeof(header), NULL, 0, NULL, 0);
+}
+
+void mos6502_cache_bank(const uint16_t bank) {
+  const uint8_t header[3] = {MOS6502_CACHE_BANK, (uint8_t)bank,
+                             (uint8_t)(bank >> 8)};
+
+  cache_record(header, sizeof(header), NULL, 0, NULL, 0);
+}
+
+void mos6502_cache_window(const uint16_t base, const uint16_t size,
+                          const uint16_t control) {
+  const uint8_t header[7] = {
+      MOS6502_CACHE_WINDOW, (uint8_t)base,    (uint8_t)(base >> 8),
+      (uint8_t)size,        (uint8_t)(size >> 8), (uint8_t)control,
+      (uint8_t)(control >> 8),
+  };
+
+  cache_record(header, sizeof(header), NULL, 0, NULL, 0);
+}
+
+void mos6502_cache_macro(const char *name, const size_t name_length,
+                         const char *body, const size_t body_length) {
+  const uint8_t header[7] = {
+      MOS6502_CACHE_MACRO,
+      (uint8_t)name_length,
+      (uint8_t)(name_length >> 8),
+      (uint8_t)body_length,
+      (uint8_t)(body_length >> 8),
+      (uint8_t)(body_length >> 16),
+      (uint8_t)(body_length >> 24),
+  };
+
+  cache_record(header, sizeof(header), name, name_length, body, body_length);
+}
+
+static int cache_keep(uint8_t *data) {
+  if (cache_loaded_count == cache_loaded_capacity) {
+    const size_t capacity =
+        (0 == cache_loaded_capacity) ? 16 : cache_loaded_capacity * 2;
+
+    uint8_t **loaded =
+        (uint8_t **)realloc(cache_loaded, capacity * sizeof(uint8_t *));
+
+    if (NULL == loaded) {
+      return 0;
+    }
+
+    cache_loaded = loaded;
+    cache_loaded_capacity = capacity;
+  }
+
+  cache_loaded[cache_loaded_count++] = data;
+
+  return 1;
+}
+
+/*
+ * Walks the dependency list of a loaded fragment. With check set it rehashes
+ * every file and fails on the first one that changed; otherwise it adds them
+ * to the fragments being recorded.
+ */
+static int cache_dependencies(const uint8_t *at, const uint8_t *end,
+                              const uint32_t count, const int check,
+                              const uint8_t **ops) {
+  for (uint32_t index = 0; index < count; ++index) {
+    if (end - at < 2) {
+      return 0;
+    }
+
+    const size_t length = cache_get_u16(at);
+
+    if ((size_t)(end - at) < 2 + length + 8) {
+      return 0;
+    }
+
+    char *path = (char *)malloc(length + 1);
+
+    if (NULL == path) {
+      return 0;
+    }
+
+    memcpy(path, at + 2, length);
+    path[length] = '\0';
+
+    const uint64_t expected = cache_get_u64(at + 2 + length);
+    uint64_t actual = 0;
+
+    if (check && (!cache_hash_file(path, &actual) || actual != expected)) {
+      free(path);
+      return 0;
+    }
+
+    if (!check) {
+      mos6502_cache_depend(path, expected);
+    }
+
+    free(path);
+
+    at += 2 + length + 8;
+  }
+
+  *ops = at;
+
+  return 1;
+}
+
+/* A fragment is only usable if every op decodes and END closes the stream. */
+static int cache_complete(const uint8_t *at, const uint8_t *end) {
+  MOS6502_CacheOp op;
+
+  while (mos6502_cache_next(&at, end, &op)) {
+    if (MOS6502_CACHE_END == op.kind) {
+      return at == end;
+    }
+  }
+
+  return 0;
+}
+
+int mos6502_cache_lookup(const uint64_t key, const uint8_t **ops,
+                         size_t *length) {
+  char path[4096];
+
+  if (!cache_path(path, sizeof(path), key, "")) {
+    return 0;
+  }
+
+  FILE *stream = fopen(path, "rb");
+
+  if (NULL == stream) {
+    return 0;
+  }
+
+  uint8_t *data = NULL;
+  long size = -1;
+
+  if (0 == fseek(stream, 0, SEEK_END) && 0 <= (size = ftell(stream)) &&
+      0 == fseek(stream, 0, SEEK_SET)) {
+    data = (uint8_t *)malloc((size_t)size + 1);
+  }
+
+  const int read = NULL != data &&
+                   (0 == size || 1 == fread(data, (size_t)size, 1, stream));
+
+  fclose(stream);
+
+  if (!read || size < 8 ||
+      0 != memcmp(data, MOS6502_CACHE_MAGIC, sizeof(MOS6502_CACHE_MAGIC))) {
+    free(data);
+    return 0;
+  }
+
+  const uint8_t *end = data + size;
+  const uint8_t *at = data;
+  const uint32_t count = (uint32_t)(data[4] | (data[5] << 8) |
+                                    (data[6] << 16) | ((uint32_t)data[7] << 24));
+
+  if (!cache_dependencies(data + 8, end, count, 1, &at) || end - at < 8 ||
+      cache_get_u64(at) != (uint64_t)(end - at - 8) ||
+      !cache_complete(at + 8, end) || !cache_keep(data)) {
+    free(data);
+    return 0;
+  }
+
+  cache_dependencies(data + 8, end, count, 0, &at);
+
+  *ops = at + 8;
+  *length = (size_t)(end - at - 8);
+
+  return 1;
+}
+
+int mos6502_cache_next(const uint8_t **cursor, const uint8_t *end,
+                       MOS6502_CacheOp *op) {
+  const uint8_t *at = *cursor;
+  const size_t remaining = (size_t)(end - at);
+  size_t length = 0;
+
+  if (at >= end) {
+    return 0;
+  }
+
+  memset(op, 0, sizeof(MOS6502_CacheOp));
+
+  op->kind = at[0];
+
+  switch (op->kind) {
+    case MOS6502_CACHE_WRITE:
+      if (remaining < 5) {
+        return 0;
+      }
+      op->address = cache_get_u16(at + 1);
+      op->count = cache_get_u16(at + 3);
+      op->bytes = at + 5;
+      length = 5 + op->count;
+      break;
+    case MOS6502_CACHE_LABEL:
+      if (remaining < 5) {
+        return 0;
+      }
+      op->address = cache_get_u16(at + 1);
+      op->name_length = cache_get_u16(at + 3);
+      op->name = (const char *)(at + 5);
+      length = 5 + op->name_length;
+      break;
+    case MOS6502_CACHE_REFERENCE:
+      if (remaining < 6) {
+        return 0;
+      }
+      op->type = at[1];
+      op->address = cache_get_u16(at + 2);
+      op->name_length = cache_get_u16(at + 4);
+      op->name = (const char *)(at + 6);
+      length = 6 + op->name_length;
+      break;
+    case MOS6502_CACHE_ORIGIN:
+    case MOS6502_CACHE_END:
+      if (remaining < 3) {
+        return 0;
+      }
+      op->address = cache_get_u16(at + 1);
+      length = 3;
+      break;
+    case MOS6502_CACHE_BANK:
+      if (remaining < 3) {
+        return 0;
+      }
+      op->bank = cache_get_u16(at + 1);
+      length = 3;
+      break;
+    case MOS6502_CACHE_WINDOW:
+      if (remaining < 7) {
+        return 0;
+      }
+      op->address = cache_get_u16(at + 1);
+      op->size = cache_get_u16(at + 3);
+      op->control = cache_get_u16(at + 5);
+      length = 7;
+      break;
+    case MOS6502_CACHE_MACRO:
+      if (remaining < 7) {
+        return 0;
+      }
+      op->name_length = cache_get_u16(at + 1);
+      op->body_length = (size_t)at[3] | ((size_t)at[4] << 8) |
+                        ((size_t)at[5] << 16) | ((size_t)at[6] << 24);
+      op->name = (const char *)(at + 7);
+      op->body = op->name + op->name_length;
+      length = 7 + op->name_length + op->body_length;
+      break;
+    default:
+      return 0;
+  }
+
+  if (remaining < length) {
+    return 0;
+  }
+
+  *cursor = at + length;
+
+  return 1;
+}
+
+void mos6502_cache_close(void) {
+  while (0 < cache_depth) {
+    cache_free(&cache_fragments[--cache_depth]);
+  }
+
+  for (size_t index = 0; index < cache_loaded_count; ++index) {
+    free(cache_loaded[index]);
+  }
+
+  free(cache_loaded);
+
+  cache_loaded = NULL;
+  cache_loaded_count = 0;
+  cache_loaded_capacity = 0;
+}
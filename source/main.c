@@ -1,20 +1,62 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "cache.h"
 #include "mos6502.h"
 #include "parser.tab.h"
 
-extern FILE *yyin;
+#define IMAGE_SIZE 0x100000
+
 extern int yylineno;
 
+extern int lexer_open(const char *);
+extern void lexer_close(void);
+
 MOS6502 *CPU = NULL;
 
+FILE *AOT = NULL;
+
+char AOT_NAME[256];
+
 void yyerror(const char *s) {
   fprintf(stderr, "Parse error at line %d: %s\n", yylineno, s);
 }
 
+/* Derives the C prefix of a translation from its file name: out/boot.c -> boot */
+static void aot_name(const char *path) {
+  const char *base = strrchr(path, '/');
+  base = (NULL == base) ? path : base + 1;
+
+  size_t length = 0;
+
+  if (isdigit((unsigned char)base[0])) {
+    AOT_NAME[length++] = '_';
+  }
+
+  for (; '\0' != *base && '.' != *base && length + 1 < sizeof(AOT_NAME);
+       ++base) {
+    AOT_NAME[length++] = isalnum((unsigned char)*base) ? *base : '_';
+  }
+
+  AOT_NAME[length] = '\0';
+}
+
+/* Closes and removes a translation that will not be finished. */
+static void aot_discard(const char *path) {
+  if (NULL == AOT) {
+    return;
+  }
+
+  fclose(AOT);
+  AOT = NULL;
+
+  remove(path);
+}
+
 int main(const int argc, const char **argv) {
-  if (2 != argc) {
+  if (2 != argc && 3 != argc) {
     fprintf(stderr, "MOS6502: You must provide an .asm file\n");
 
     return 1;
@@ -22,11 +64,29 @@ int main(const int argc, const char **argv) {
 
   const char *filename = argv[1];
 
-  yyin = fopen(filename, "r");
+  if (3 == argc) {
+    aot_name(argv[2]);
+
+    if ('\0' == AOT_NAME[0]) {
+      fprintf(stderr, "MOS6502: '%s' is not a valid translation name\n",
+              argv[2]);
 
-  if (NULL == yyin) {
+      return 1;
+    }
+
+    AOT = fopen(argv[2], "w");
+
+    if (NULL == AOT) {
+      fprintf(stderr, "MOS6502: Unable to create the '%s' file\n", argv[2]);
+
+      return 1;
+    }
+  }
+
+  if (!lexer_open(filename)) {
     fprintf(stderr, "MOS6502: Unable to open the '%s' file\n", filename);
 
+    aot_discard(argv[2]);
     return 1;
   }
 
@@ -35,18 +95,45 @@ int main(const int argc, const char **argv) {
   if (NULL == CPU) {
     fprintf(stderr, "MOS6502: Virtual machine could not be started\n");
 
-    fclose(yyin);
+    aot_discard(argv[2]);
+    lexer_close();
+    return 1;
+  }
+
+  uint8_t *image = (uint8_t *)calloc(IMAGE_SIZE, sizeof(uint8_t));
+
+  if (NULL == image) {
+    fprintf(stderr, "MOS6502: Bank image could not be allocated\n");
+
+    aot_discard(argv[2]);
+    mos6502_destruct(CPU);
+    lexer_close();
     return 1;
   }
 
+  mos6502_set_image(CPU, image, IMAGE_SIZE);
+
   int parse_result = yyparse();
 
-  fclose(yyin);
+  lexer_close();
+
+  mos6502_cache_close();
 
   mos6502_destruct(CPU);
 
+  free(image);
+
   if (parse_result != 0) {
     fprintf(stderr, "Yacc: Parsing failed.\n");
+
+    aot_discard(argv[2]);
+    return 1;
+  }
+
+  if (NULL != AOT && 0 != fclose(AOT)) {
+    fprintf(stderr, "MOS6502: Unable to write the '%s' file\n", argv[2]);
+
+    remove(argv[2]);
     return 1;
   }
 
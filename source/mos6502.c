@@ -1,7 +1,10 @@
 #include "mos6502.h"
 
+#include "replay.h"
+
 #include <assert.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,6 +26,128 @@ void mos6502_update_z_n_status(MOS6502 *this, const uint8_t value) {
   }
 }
 
+#define MOS6502_ARITHMETIC_FLAGS                                               \
+  (MOS6502_STATUS_C | MOS6502_STATUS_Z | MOS6502_STATUS_V | MOS6502_STATUS_N)
+
+/*
+ * Decimal ADC and SBC, indexed by carry, A and the operand. Each entry holds
+ * the result in its low byte and the C, Z, V and N flags in its high byte, so
+ * decimal mode costs one load instead of the nibble corrections. Filled in
+ * once, by whichever thread first runs a decimal ADC or SBC.
+ */
+static uint16_t MOS6502_ADC_DECIMAL_TABLE[2 * 256 * 256];
+static uint16_t MOS6502_SBC_DECIMAL_TABLE[2 * 256 * 256];
+static pthread_once_t MOS6502_DECIMAL_TABLES_ONCE = PTHREAD_ONCE_INIT;
+
+/* Flags of the binary sum A + operand + carry, SBC being ADC of ~operand. */
+static uint8_t mos6502_binary_flags(const uint8_t a, const uint8_t operand,
+                                    const uint16_t sum) {
+  const uint8_t result = (uint8_t)sum;
+
+  return (uint8_t)((sum >> 8) | ((0 == result) << 1) |
+                   (((a ^ result) & (operand ^ result) & 0x80) >> 1) |
+                   (result & MOS6502_STATUS_N));
+}
+
+/*
+ * What an NMOS 6502 does in decimal mode, non-BCD digits included. ADC takes
+ * Z from the binary sum and N and V from the high digit before it is
+ * adjusted; SBC sets every flag as in binary mode.
+ */
+static uint16_t mos6502_decimal_adc(const uint8_t a, const uint8_t operand,
+                                    const uint8_t carry) {
+  int low = (a & 0x0F) + (operand & 0x0F) + carry;
+
+  if (0x0A <= low) {
+    low = ((low + 0x06) & 0x0F) + 0x10;
+  }
+
+  int sum = (a & 0xF0) + (operand & 0xF0) + low;
+  const int high = (int8_t)(a & 0xF0) + (int8_t)(operand & 0xF0) + low;
+
+  uint8_t flags = (uint8_t)(high & MOS6502_STATUS_N);
+
+  if (high < -128 || 127 < high) {
+    flags |= MOS6502_STATUS_V;
+  }
+
+  if (0 == (uint8_t)(a + operand + carry)) {
+    flags |= MOS6502_STATUS_Z;
+  }
+
+  if (0xA0 <= sum) {
+    sum += 0x60;
+  }
+
+  if (0x100 <= sum) {
+    flags |= MOS6502_STATUS_C;
+  }
+
+  return (uint16_t)((flags << 8) | (sum & 0xFF));
+}
+
+static uint16_t mos6502_decimal_sbc(const uint8_t a, const uint8_t operand,
+                                    const uint8_t carry) {
+  int low = (a & 0x0F) - (operand & 0x0F) + carry - 1;
+
+  if (low < 0) {
+    low = ((low - 0x06) & 0x0F) - 0x10;
+  }
+
+  int difference = (a & 0xF0) - (operand & 0xF0) + low;
+
+  if (difference < 0) {
+    difference -= 0x60;
+  }
+
+  const uint8_t inverse = (uint8_t)~operand;
+  const uint8_t flags =
+      mos6502_binary_flags(a, inverse, (uint16_t)(a + inverse + carry));
+
+  return (uint16_t)((flags << 8) | (difference & 0xFF));
+}
+
+static void mos6502_build_decimal_tables(void) {
+  for (uint32_t index = 0; index < 2 * 256 * 256; ++index) {
+    const uint8_t carry = (uint8_t)(index >> 16);
+    const uint8_t a = (uint8_t)(index >> 8);
+    const uint8_t operand = (uint8_t)index;
+
+    MOS6502_ADC_DECIMAL_TABLE[index] = mos6502_decimal_adc(a, operand, carry);
+    MOS6502_SBC_DECIMAL_TABLE[index] = mos6502_decimal_sbc(a, operand, carry);
+  }
+}
+
+static void mos6502_add(MOS6502 *this, const uint8_t operand,
+                        const uint16_t *decimal, const uint8_t decimal_operand) {
+  const uint8_t carry = this->P & MOS6502_STATUS_C;
+
+  if (this->P & MOS6502_STATUS_D) {
+    pthread_once(&MOS6502_DECIMAL_TABLES_ONCE, mos6502_build_decimal_tables);
+
+    const uint16_t entry =
+        decimal[((uint32_t)carry << 16) | (this->A << 8) | decimal_operand];
+
+    this->A = (uint8_t)entry;
+    this->P = (this->P & ~MOS6502_ARITHMETIC_FLAGS) | (entry >> 8);
+    return;
+  }
+
+  const uint16_t sum = this->A + operand + carry;
+
+  this->P = (this->P & ~MOS6502_ARITHMETIC_FLAGS) |
+            mos6502_binary_flags(this->A, operand, sum);
+  this->A = (uint8_t)sum;
+}
+
+void mos6502_adc(MOS6502 *this, const uint8_t operand) {
+  mos6502_add(this, operand, MOS6502_ADC_DECIMAL_TABLE, operand);
+}
+
+void mos6502_sbc(MOS6502 *this, const uint8_t operand) {
+  mos6502_add(this, (uint8_t)~operand, MOS6502_SBC_DECIMAL_TABLE, operand);
+}
+
 void LDX_IMMEDIATE_MODE(MOS6502 *this) {
   const uint8_t operand = mos6502_read(this, this->PC + 1);
 
@@ -46,6 +171,10 @@ void LDA_ABSOLUTE_X_MODE(MOS6502 *this) {
 
   const uint16_t address = base_address + this->X;
 
+  if ((base_address & 0xFF00) != (address & 0xFF00)) {
+    ++this->CYCLES;
+  }
+
   this->A = mos6502_read(this, address);
 
   this->PC += 3;
@@ -58,7 +187,12 @@ void BEQ_RELATIVE_MODE(MOS6502 *this) {
   this->PC += 2;
 
   if (mos6502_get_status(this, MOS6502_STATUS_Z)) {
+    const uint16_t origin = this->PC;
+
     this->PC += offset;
+
+    this->CYCLES += ((origin & 0xFF00) != (this->PC & 0xFF00)) ? 2 : 1;
+
     fprintf(stdout, "MOS6502: Branch taken to 0x%04X (BEQ offset %d)\n",
             this->PC, offset);
   } else {
@@ -100,6 +234,8 @@ void JMP_ABSOLUTE_MODE(MOS6502 *this) {
   this->PC = target_address;
 }
 
+static uint16_t mos6502_read_vector(MOS6502 *, const uint16_t);
+
 void BRK_IMPLIED_MODE(MOS6502 *this) {
   fprintf(stdout,
           "MOS6502: Break command (BRK). Pushing PC and P, jumping to IRQ/BRK "
@@ -113,11 +249,64 @@ void BRK_IMPLIED_MODE(MOS6502 *this) {
   mos6502_set_status(this, MOS6502_STATUS_I);
   mos6502_clear_status(this, MOS6502_STATUS_B);
 
-  this->PC = mos6502_read(this, MOS6502_VEC_IRQ) |
-             ((uint16_t)mos6502_read(this, MOS6502_VEC_IRQ + 1) << 8);
+  this->PC = mos6502_read_vector(this, MOS6502_VEC_IRQ);
+}
+
+void ADC_IMMEDIATE_MODE(MOS6502 *this) {
+  const uint8_t operand = mos6502_read(this, this->PC + 1);
+
+  fprintf(stdout, "MOS6502: Adding %02X to REG A (ADC #$%02X)\n", operand,
+          operand);
+
+  mos6502_adc(this, operand);
+
+  this->PC += 2;
+}
+
+void SBC_IMMEDIATE_MODE(MOS6502 *this) {
+  const uint8_t operand = mos6502_read(this, this->PC + 1);
+
+  fprintf(stdout, "MOS6502: Subtracting %02X from REG A (SBC #$%02X)\n",
+          operand, operand);
+
+  mos6502_sbc(this, operand);
+
+  this->PC += 2;
+}
+
+void CLC_IMPLIED_MODE(MOS6502 *this) {
+  fprintf(stdout, "MOS6502: Clearing carry flag (CLC)\n");
+
+  mos6502_clear_status(this, MOS6502_STATUS_C);
+
+  this->PC += 1;
+}
+
+void SEC_IMPLIED_MODE(MOS6502 *this) {
+  fprintf(stdout, "MOS6502: Setting carry flag (SEC)\n");
+
+  mos6502_set_status(this, MOS6502_STATUS_C);
+
+  this->PC += 1;
+}
+
+void CLD_IMPLIED_MODE(MOS6502 *this) {
+  fprintf(stdout, "MOS6502: Clearing decimal flag (CLD)\n");
+
+  mos6502_clear_status(this, MOS6502_STATUS_D);
+
+  this->PC += 1;
+}
+
+void SED_IMPLIED_MODE(MOS6502 *this) {
+  fprintf(stdout, "MOS6502: Setting decimal flag (SED)\n");
+
+  mos6502_set_status(this, MOS6502_STATUS_D);
+
+  this->PC += 1;
 }
 
-static const mos6502_instruction_handler MOS6502_INSTRUCTIONS_TABLE[] = {
+static const mos6502_instruction_handler MOS6502_INSTRUCTIONS_TABLE[256] = {
     [MOS6502_LDX_IMMEDIATE_MODE] = LDX_IMMEDIATE_MODE,
     [MOS6502_LDA_ABSOLUTE_X_MODE] = LDA_ABSOLUTE_X_MODE,
     [MOS6502_BEQ_RELATIVE_MODE] = BEQ_RELATIVE_MODE,
@@ -125,6 +314,22 @@ static const mos6502_instruction_handler MOS6502_INSTRUCTIONS_TABLE[] = {
     [MOS6502_INX_IMPLIED_MODE] = INX_IMPLIED_MODE,
     [MOS6502_JMP_ABSOLUTE_MODE] = JMP_ABSOLUTE_MODE,
     [MOS6502_BRK_IMPLIED_MODE] = BRK_IMPLIED_MODE,
+    [MOS6502_ADC_IMMEDIATE_MODE] = ADC_IMMEDIATE_MODE,
+    [MOS6502_SBC_IMMEDIATE_MODE] = SBC_IMMEDIATE_MODE,
+    [MOS6502_CLC_IMPLIED_MODE] = CLC_IMPLIED_MODE,
+    [MOS6502_SEC_IMPLIED_MODE] = SEC_IMPLIED_MODE,
+    [MOS6502_CLD_IMPLIED_MODE] = CLD_IMPLIED_MODE,
+    [MOS6502_SED_IMPLIED_MODE] = SED_IMPLIED_MODE,
+};
+
+static const uint8_t MOS6502_CYCLES_TABLE[256] = {
+    [MOS6502_LDX_IMMEDIATE_MODE] = 2, [MOS6502_LDA_ABSOLUTE_X_MODE] = 4,
+    [MOS6502_BEQ_RELATIVE_MODE] = 2,  [MOS6502_STA_ABSOLUTE_MODE] = 4,
+    [MOS6502_INX_IMPLIED_MODE] = 2,   [MOS6502_JMP_ABSOLUTE_MODE] = 3,
+    [MOS6502_BRK_IMPLIED_MODE] = 7,  [MOS6502_ADC_IMMEDIATE_MODE] = 2,
+    [MOS6502_SBC_IMMEDIATE_MODE] = 2, [MOS6502_CLC_IMPLIED_MODE] = 2,
+    [MOS6502_SEC_IMPLIED_MODE] = 2,   [MOS6502_CLD_IMPLIED_MODE] = 2,
+    [MOS6502_SED_IMPLIED_MODE] = 2,
 };
 
 MOS6502 *mos6502_construct(void) {
@@ -136,6 +341,10 @@ MOS6502 *mos6502_construct(void) {
 
   memset(this, 0, sizeof(MOS6502));
 
+  for (uint32_t page = 0; page < MOS6502_PAGE_COUNT; ++page) {
+    this->PAGES[page] = &this->BUS[page * MOS6502_PAGE_SIZE];
+  }
+
   this->PC = MOS6502_VEC_RESET;
 
   this->SP = 0xFD;
@@ -149,17 +358,135 @@ void mos6502_destruct(MOS6502 *this) {
   free(this);
 }
 
-uint8_t mos6502_read(const MOS6502 *this, const uint16_t address) {
+static void mos6502_trap(MOS6502 *this, const uint8_t kind,
+                         const uint16_t address) {
+  for (uint8_t index = 0; index < this->TRAP_COUNT; ++index) {
+    const MOS6502_Trap trap = this->TRAPS[index];
+
+    if (trap.address != address || !(trap.kinds & kind)) {
+      continue;
+    }
+
+    fprintf(stdout, "MOS6502: Trap 0x%02X hit at '0x%04X' address\n", kind,
+            address);
+
+    if (NULL == this->TRAP_HANDLER ||
+        this->TRAP_HANDLER(this, kind, address, this->TRAP_CONTEXT)) {
+      this->STATE = MOS6502_STATE_PAUSED;
+    }
+
+    return;
+  }
+}
+
+static uint8_t mos6502_read_port(MOS6502 *this, const uint16_t address) {
+  for (uint8_t index = 0; index < this->PORT_COUNT; ++index) {
+    MOS6502_Port *port = &this->PORTS[index];
+
+    if (port->address != address) {
+      continue;
+    }
+
+    uint8_t replayed = 0;
+
+    if (NULL != this->REPLAY && mos6502_replay_port(this, address, &replayed)) {
+      return replayed;
+    }
+
+    if (0 == port->count) {
+      fprintf(stdout, "MOS6502: Waiting for input on port '0x%04X'\n",
+              address);
+
+      this->STARVED = 1;
+
+      if (MOS6502_STATE_PAUSED != this->STATE) {
+        this->STATE = MOS6502_STATE_WAITING;
+      }
+      return 0;
+    }
+
+    const uint8_t value = port->queue[port->head];
+
+    port->head = (port->head + 1) % MOS6502_PORT_QUEUE_SIZE;
+    --port->count;
+
+    if (NULL != this->RECORD) {
+      mos6502_record_event(this, MOS6502_EVENT_PORT, address, value);
+    }
+
+    return value;
+  }
+
+  return this->PAGES[address >> 8][address & 0xFF];
+}
+
+uint8_t mos6502_read(MOS6502 *this, const uint16_t address) {
   fprintf(stdout, "MOS6502: Reading address '0x%04X'\n", address);
 
-  return this->BUS[address];
+  const uint8_t flags = this->PAGE_FLAGS[address >> 8];
+
+  if (flags & MOS6502_TRAP_READ) {
+    mos6502_trap(this, MOS6502_TRAP_READ, address);
+  }
+
+  if (flags & MOS6502_PAGE_PORT) {
+    return mos6502_read_port(this, address);
+  }
+
+  return this->PAGES[address >> 8][address & 0xFF];
+}
+
+/*
+ * Vectors are fetched after the pushes, which rolling back the registers
+ * would not undo, so they never wait on a port: a port there reads as the
+ * memory behind it. Watchpoints still fire.
+ */
+static uint16_t mos6502_read_vector(MOS6502 *this, const uint16_t vector) {
+  uint16_t value = 0;
+
+  for (uint8_t index = 0; index < 2; ++index) {
+    const uint16_t address = vector + index;
+
+    fprintf(stdout, "MOS6502: Reading address '0x%04X'\n", address);
+
+    if (this->PAGE_FLAGS[address >> 8] & MOS6502_TRAP_READ) {
+      mos6502_trap(this, MOS6502_TRAP_READ, address);
+    }
+
+    value |= (uint16_t)this->PAGES[address >> 8][address & 0xFF] << (8 * index);
+  }
+
+  return value;
+}
+
+static int mos6502_write_control(MOS6502 *this, const uint16_t address,
+                                 const uint8_t value) {
+  for (uint8_t index = 0; index < this->WINDOW_COUNT; ++index) {
+    if (this->WINDOWS[index].control == address) {
+      mos6502_select_bank(this, index, value);
+      return 1;
+    }
+  }
+
+  return 0;
 }
 
 void mos6502_write(MOS6502 *this, const uint16_t address, const uint8_t value) {
   fprintf(stdout, "MOS6502: Writing '0x%02X' on '0x%04X' address\n", value,
           address);
 
-  this->BUS[address] = value;
+  const uint8_t flags = this->PAGE_FLAGS[address >> 8];
+
+  if (flags & MOS6502_TRAP_WRITE) {
+    mos6502_trap(this, MOS6502_TRAP_WRITE, address);
+  }
+
+  if ((flags & MOS6502_PAGE_BANK) &&
+      mos6502_write_control(this, address, value)) {
+    return;
+  }
+
+  this->PAGES[address >> 8][address & 0xFF] = value;
 }
 
 void mos6502_set_status(MOS6502 *this, const uint8_t status) {
@@ -178,7 +505,11 @@ void mos6502_push(MOS6502 *this, const uint8_t value) {
   fprintf(stdout, "MOS6502: Pushing 0x%02X on STACK 0x%04X address\n", value,
           MOS6502_STACK + this->SP);
 
-  this->BUS[MOS6502_STACK + this->SP] = value;
+  if (this->PAGE_FLAGS[MOS6502_STACK >> 8] & MOS6502_TRAP_WRITE) {
+    mos6502_trap(this, MOS6502_TRAP_WRITE, MOS6502_STACK + this->SP);
+  }
+
+  this->PAGES[MOS6502_STACK >> 8][this->SP] = value;
 
   --this->SP;
   fprintf(stdout, "MOS6502: Decrementing STACK POINTER to 0x%02X\n", this->SP);
@@ -188,16 +519,102 @@ uint8_t mos6502_pop(MOS6502 *this) {
   ++this->SP;
   fprintf(stdout, "MOS6502: Incrementing STACK POINTER to 0x%02X\n", this->SP);
 
-  uint8_t value = this->BUS[MOS6502_STACK + this->SP];
+  if (this->PAGE_FLAGS[MOS6502_STACK >> 8] & MOS6502_TRAP_READ) {
+    mos6502_trap(this, MOS6502_TRAP_READ, MOS6502_STACK + this->SP);
+  }
+
+  uint8_t value = this->PAGES[MOS6502_STACK >> 8][this->SP];
   fprintf(stdout, "MOS6502: Popping 0x%02X from 0x%04X address\n", value,
           MOS6502_STACK + this->SP);
 
   return value;
 }
 
+static void mos6502_interrupt(MOS6502 *this, const uint16_t vector) {
+  fprintf(stdout, "MOS6502: Interrupt. Pushing PC and P, jumping to 0x%04X "
+                  "vector.\n",
+          vector);
+
+  mos6502_push(this, this->PC >> 8);
+  mos6502_push(this, this->PC & 0xFF);
+
+  mos6502_push(this, this->P & ~MOS6502_STATUS_B);
+
+  mos6502_set_status(this, MOS6502_STATUS_I);
+
+  this->PC = mos6502_read_vector(this, vector);
+
+  this->CYCLES += 7;
+
+  this->TRAPPED = 0;
+  this->STARVED = 0;
+
+  if (MOS6502_STATE_WAITING == this->STATE) {
+    this->STATE = MOS6502_STATE_RUNNING;
+  }
+}
+
+int mos6502_irq(MOS6502 *this) {
+  if (NULL != this->REPLAY || mos6502_get_status(this, MOS6502_STATUS_I)) {
+    return 0;
+  }
+
+  if (NULL != this->RECORD) {
+    mos6502_record_event(this, MOS6502_EVENT_IRQ, 0, 0);
+  }
+
+  mos6502_interrupt(this, MOS6502_VEC_IRQ);
+
+  return 1;
+}
+
+void mos6502_nmi(MOS6502 *this) {
+  if (NULL != this->REPLAY) {
+    return;
+  }
+
+  if (NULL != this->RECORD) {
+    mos6502_record_event(this, MOS6502_EVENT_NMI, 0, 0);
+  }
+
+  mos6502_interrupt(this, MOS6502_VEC_NMI);
+}
+
 void mos6502_execute(MOS6502 *this) {
+  if (MOS6502_STATE_RUNNING != this->STATE) {
+    return;
+  }
+
+  if (NULL != this->REPLAY) {
+    uint8_t kind;
+
+    while (0 != (kind = mos6502_replay_interrupt(this))) {
+      mos6502_interrupt(this, (MOS6502_EVENT_NMI == kind) ? MOS6502_VEC_NMI
+                                                         : MOS6502_VEC_IRQ);
+    }
+  }
+
+  if (!this->TRAPPED &&
+      (this->PAGE_FLAGS[this->PC >> 8] & MOS6502_TRAP_EXECUTE)) {
+    mos6502_trap(this, MOS6502_TRAP_EXECUTE, this->PC);
+
+    if (MOS6502_STATE_RUNNING != this->STATE) {
+      /* Step over this breakpoint once resumed instead of hitting it again. */
+      this->TRAPPED = 1;
+      return;
+    }
+  }
+
+  this->TRAPPED = 0;
+
   const uint8_t opcode = mos6502_read(this, this->PC);
 
+  /* A port at PC has nothing to give yet; a watchpoint that paused on the
+   * fetch lets the instruction finish, like any other read. */
+  if (this->STARVED) {
+    return;
+  }
+
   fprintf(stdout, "MOS6502: Executing instruction 0x%02X at 0x%04X\n", opcode,
           this->PC);
 
@@ -212,11 +629,283 @@ void mos6502_execute(MOS6502 *this) {
     return;
   }
 
+  const uint16_t pc = this->PC;
+  const uint8_t a = this->A, x = this->X, y = this->Y, p = this->P,
+                sp = this->SP;
+  const uint64_t cycles = this->CYCLES;
+
   handler(this);
+
+  if (this->STARVED) {
+    /*
+     * An input port had nothing to give: roll the registers back so the
+     * instruction restarts from scratch once mos6502_feed wakes us up. That
+     * undoes everything because only operand reads can wait, and every
+     * implemented instruction reads its operands before writing memory; BRK
+     * pushes first but fetches its vector with mos6502_read_vector, which
+     * never waits.
+     */
+    this->PC = pc;
+    this->A = a;
+    this->X = x;
+    this->Y = y;
+    this->P = p;
+    this->SP = sp;
+    this->CYCLES = cycles;
+    return;
+  }
+
+  this->CYCLES += MOS6502_CYCLES_TABLE[opcode];
+}
+
+uint8_t mos6502_run(MOS6502 *this, const uint64_t cycles) {
+  const uint64_t limit = this->CYCLES + cycles;
+
+  while (MOS6502_STATE_RUNNING == this->STATE && this->CYCLES < limit) {
+    mos6502_execute(this);
+  }
+
+  return this->STATE;
+}
+
+static void mos6502_refresh_page_flags(MOS6502 *this, const uint8_t page) {
+  uint8_t flags = 0;
+
+  for (uint8_t index = 0; index < this->TRAP_COUNT; ++index) {
+    if (page == (this->TRAPS[index].address >> 8)) {
+      flags |= this->TRAPS[index].kinds;
+    }
+  }
+
+  for (uint8_t index = 0; index < this->PORT_COUNT; ++index) {
+    if (page == (this->PORTS[index].address >> 8)) {
+      flags |= MOS6502_PAGE_PORT;
+    }
+  }
+
+  for (uint8_t index = 0; index < this->WINDOW_COUNT; ++index) {
+    if (page == (this->WINDOWS[index].control >> 8)) {
+      flags |= MOS6502_PAGE_BANK;
+    }
+  }
+
+  this->PAGE_FLAGS[page] = flags;
+}
+
+int mos6502_add_trap(MOS6502 *this, const uint16_t address,
+                     const uint8_t kinds) {
+  for (uint8_t index = 0; index < this->TRAP_COUNT; ++index) {
+    if (this->TRAPS[index].address == address) {
+      this->TRAPS[index].kinds |= kinds;
+      this->PAGE_FLAGS[address >> 8] |= kinds;
+      return 1;
+    }
+  }
+
+  if (MOS6502_MAX_TRAPS <= this->TRAP_COUNT) {
+    fprintf(stderr, "MOS6502: Max %d traps allowed\n", MOS6502_MAX_TRAPS);
+    return 0;
+  }
+
+  this->TRAPS[this->TRAP_COUNT].address = address;
+  this->TRAPS[this->TRAP_COUNT].kinds = kinds;
+  ++this->TRAP_COUNT;
+
+  this->PAGE_FLAGS[address >> 8] |= kinds;
+
+  return 1;
+}
+
+void mos6502_remove_trap(MOS6502 *this, const uint16_t address,
+                         const uint8_t kinds) {
+  for (uint8_t index = 0; index < this->TRAP_COUNT; ++index) {
+    if (this->TRAPS[index].address != address) {
+      continue;
+    }
+
+    this->TRAPS[index].kinds &= ~kinds;
+
+    if (0 == this->TRAPS[index].kinds) {
+      this->TRAPS[index] = this->TRAPS[--this->TRAP_COUNT];
+    }
+
+    break;
+  }
+
+  mos6502_refresh_page_flags(this, address >> 8);
+}
+
+void mos6502_set_trap_handler(MOS6502 *this, mos6502_trap_handler handler,
+                              void *context) {
+  this->TRAP_HANDLER = handler;
+  this->TRAP_CONTEXT = context;
+}
+
+void mos6502_resume(MOS6502 *this) {
+  if (MOS6502_STATE_PAUSED != this->STATE) {
+    return;
+  }
+
+  this->STATE =
+      this->STARVED ? MOS6502_STATE_WAITING : MOS6502_STATE_RUNNING;
+}
+
+int mos6502_add_port(MOS6502 *this, const uint16_t address) {
+  if (MOS6502_MAX_PORTS <= this->PORT_COUNT) {
+    fprintf(stderr, "MOS6502: Max %d ports allowed\n", MOS6502_MAX_PORTS);
+    return 0;
+  }
+
+  memset(&this->PORTS[this->PORT_COUNT], 0, sizeof(MOS6502_Port));
+  this->PORTS[this->PORT_COUNT].address = address;
+  ++this->PORT_COUNT;
+
+  this->PAGE_FLAGS[address >> 8] |= MOS6502_PAGE_PORT;
+
+  return 1;
+}
+
+int mos6502_feed(MOS6502 *this, const uint16_t address, const uint8_t value) {
+  for (uint8_t index = 0; index < this->PORT_COUNT; ++index) {
+    MOS6502_Port *port = &this->PORTS[index];
+
+    if (port->address != address) {
+      continue;
+    }
+
+    if (MOS6502_PORT_QUEUE_SIZE <= port->count) {
+      return 0;
+    }
+
+    port->queue[(port->head + port->count) % MOS6502_PORT_QUEUE_SIZE] = value;
+    ++port->count;
+
+    this->STARVED = 0;
+
+    if (MOS6502_STATE_WAITING == this->STATE) {
+      this->STATE = MOS6502_STATE_RUNNING;
+    }
+
+    return 1;
+  }
+
+  return 0;
+}
+
+void mos6502_set_image(MOS6502 *this, uint8_t *image, const size_t size) {
+  this->IMAGE = image;
+  this->IMAGE_SIZE = size;
+}
+
+int mos6502_add_window(MOS6502 *this, const uint16_t base, const uint16_t size,
+                       const uint16_t control) {
+  if (MOS6502_WINDOW_8K != size && MOS6502_WINDOW_16K != size) {
+    fprintf(stderr, "MOS6502: Bank window size must be 8 KiB or 16 KiB\n");
+    return 0;
+  }
+
+  if (0 != (base % size)) {
+    fprintf(stderr, "MOS6502: Bank window at '0x%04X' is not aligned\n", base);
+    return 0;
+  }
+
+  if (MOS6502_MAX_WINDOWS <= this->WINDOW_COUNT) {
+    fprintf(stderr, "MOS6502: Max %d bank windows allowed\n",
+            MOS6502_MAX_WINDOWS);
+    return 0;
+  }
+
+  for (uint8_t index = 0; index < this->WINDOW_COUNT; ++index) {
+    const MOS6502_Window window = this->WINDOWS[index];
+
+    if (base < window.base + window.size && window.base < base + size) {
+      fprintf(stderr, "MOS6502: Bank window at '0x%04X' overlaps '0x%04X'\n",
+              base, window.base);
+      return 0;
+    }
+
+    if (window.size != size) {
+      fprintf(stderr,
+              "MOS6502: Bank window at '0x%04X' must be as large as the one "
+              "at '0x%04X'\n",
+              base, window.base);
+      return 0;
+    }
+  }
+
+  /* Each window starts on a bank of its own, the first free one. */
+  const uint8_t index = this->WINDOW_COUNT;
+
+  if (NULL != this->IMAGE &&
+      this->IMAGE_SIZE < ((size_t)index + 1) * size) {
+    fprintf(stderr,
+            "MOS6502: Bank %u does not fit in the %zu byte backing image\n",
+            index, this->IMAGE_SIZE);
+    return 0;
+  }
+
+  this->WINDOWS[index].base = base;
+  this->WINDOWS[index].size = size;
+  this->WINDOWS[index].control = control;
+  this->WINDOWS[index].bank = index;
+  ++this->WINDOW_COUNT;
+
+  this->PAGE_FLAGS[control >> 8] |= MOS6502_PAGE_BANK;
+
+  if (NULL != this->IMAGE) {
+    return mos6502_select_bank(this, index, index);
+  }
+
+  return 1;
+}
+
+int mos6502_find_window(const MOS6502 *this, const uint16_t address) {
+  for (uint8_t index = 0; index < this->WINDOW_COUNT; ++index) {
+    const MOS6502_Window window = this->WINDOWS[index];
+
+    if (window.base <= address && address - window.base < window.size) {
+      return index;
+    }
+  }
+
+  return -1;
+}
+
+int mos6502_select_bank(MOS6502 *this, const uint8_t index,
+                        const uint16_t bank) {
+  if (this->WINDOW_COUNT <= index) {
+    return 0;
+  }
+
+  MOS6502_Window *window = &this->WINDOWS[index];
+
+  const size_t offset = (size_t)bank * window->size;
+
+  if (NULL == this->IMAGE || this->IMAGE_SIZE < offset + window->size) {
+    fprintf(stderr,
+            "MOS6502: Bank %u does not fit in the %zu byte backing image\n",
+            bank, this->IMAGE_SIZE);
+    return 0;
+  }
+
+  fprintf(stdout, "MOS6502: Mapping bank %u at '0x%04X'\n", bank,
+          window->base);
+
+  const uint16_t first = window->base >> 8;
+
+  for (uint16_t page = 0; page < (window->size >> 8); ++page) {
+    this->PAGES[first + page] =
+        &this->IMAGE[offset + (size_t)page * MOS6502_PAGE_SIZE];
+  }
+
+  window->bank = bank;
+
+  return 1;
 }
 
 void mos6502_dump(const MOS6502 *this, FILE *stream) {
   int change_region = 0;
+  int empty = 1;
   char region[1024];
 
   for (uint32_t index = 0; index < MOS6502_BUS_SIZE; ++index) {
@@ -251,12 +940,16 @@ void mos6502_dump(const MOS6502 *this, FILE *stream) {
         break;
     }
 
-    const uint8_t byte_val = this->BUS[index];
+    /* Through the page table, so mapped banks show instead of the BUS bytes
+     * they hide. */
+    const uint8_t byte_val = this->PAGES[index >> 8][index & 0xFF];
 
     if (0 == byte_val) {
       continue;
     }
 
+    empty = 0;
+
     if (change_region) {
       for (int8_t i = 0; i < 43; ++i) {
         fprintf(stream, "-");
@@ -270,9 +963,7 @@ void mos6502_dump(const MOS6502 *this, FILE *stream) {
     fprintf(stream, "\n");
   }
 
-  static const uint8_t nil[MOS6502_BUS_SIZE] = {0};
-
-  if (0 == memcmp(this->BUS, nil, MOS6502_BUS_SIZE)) {
+  if (empty) {
     for (int8_t i = 0; i < 43; ++i) {
       fprintf(stream, "-");
     }
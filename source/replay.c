@@ -0,0 +1,325 @@
+#include "replay.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char MOS6502_SNAPSHOT_MAGIC[4] = {'M', '6', '5', 'S'};
+
+static int replay_write(FILE *stream, const void *buffer, const size_t size) {
+  return 1 == fwrite(buffer, size, 1, stream);
+}
+
+static int replay_read(FILE *stream, void *buffer, const size_t size) {
+  return 1 == fread(buffer, size, 1, stream);
+}
+
+int mos6502_snapshot(const MOS6502 *this, FILE *stream) {
+  const uint64_t image_size = (NULL == this->IMAGE) ? 0 : this->IMAGE_SIZE;
+
+  int ok = replay_write(stream, MOS6502_SNAPSHOT_MAGIC,
+                        sizeof(MOS6502_SNAPSHOT_MAGIC));
+
+  ok = ok && replay_write(stream, &this->PC, sizeof(this->PC));
+  ok = ok && replay_write(stream, &this->A, sizeof(this->A));
+  ok = ok && replay_write(stream, &this->X, sizeof(this->X));
+  ok = ok && replay_write(stream, &this->Y, sizeof(this->Y));
+  ok = ok && replay_write(stream, &this->P, sizeof(this->P));
+  ok = ok && replay_write(stream, &this->SP, sizeof(this->SP));
+  ok = ok && replay_write(stream, &this->STATE, sizeof(this->STATE));
+  ok = ok && replay_write(stream, &this->CYCLES, sizeof(this->CYCLES));
+  ok = ok && replay_write(stream, this->BUS, MOS6502_BUS_SIZE);
+  ok = ok && replay_write(stream, &this->WINDOW_COUNT,
+                          sizeof(this->WINDOW_COUNT));
+
+  for (uint8_t index = 0; ok && index < this->WINDOW_COUNT; ++index) {
+    ok = replay_write(stream, &this->WINDOWS[index].bank,
+                      sizeof(this->WINDOWS[index].bank));
+  }
+
+  ok = ok && replay_write(stream, &image_size, sizeof(image_size));
+  ok = ok && (0 == image_size || replay_write(stream, this->IMAGE, image_size));
+
+  if (!ok) {
+    fprintf(stderr, "MOS6502: Snapshot could not be written\n");
+  }
+
+  return ok;
+}
+
+/*
+ * Everything is read into temporaries and checked before the CPU is touched,
+ * so a snapshot that does not fit or is cut short leaves it as it was.
+ */
+int mos6502_restore(MOS6502 *this, FILE *stream) {
+  char magic[sizeof(MOS6502_SNAPSHOT_MAGIC)];
+
+  if (!replay_read(stream, magic, sizeof(magic)) ||
+      0 != memcmp(magic, MOS6502_SNAPSHOT_MAGIC, sizeof(magic))) {
+    fprintf(stderr, "MOS6502: Not a snapshot\n");
+    return 0;
+  }
+
+  uint8_t *bus = (uint8_t *)malloc(MOS6502_BUS_SIZE);
+  uint8_t *image = NULL;
+
+  if (NULL == bus) {
+    fprintf(stderr, "MOS6502: Snapshot could not be loaded\n");
+    return 0;
+  }
+
+  uint16_t pc = 0;
+  uint8_t a = 0, x = 0, y = 0, p = 0, sp = 0, state = 0;
+  uint64_t cycles = 0;
+
+  int ok = replay_read(stream, &pc, sizeof(pc));
+
+  ok = ok && replay_read(stream, &a, sizeof(a));
+  ok = ok && replay_read(stream, &x, sizeof(x));
+  ok = ok && replay_read(stream, &y, sizeof(y));
+  ok = ok && replay_read(stream, &p, sizeof(p));
+  ok = ok && replay_read(stream, &sp, sizeof(sp));
+  ok = ok && replay_read(stream, &state, sizeof(state));
+  ok = ok && replay_read(stream, &cycles, sizeof(cycles));
+  ok = ok && replay_read(stream, bus, MOS6502_BUS_SIZE);
+
+  uint8_t window_count = 0;
+  uint16_t banks[MOS6502_MAX_WINDOWS] = {0};
+  uint64_t image_size = 0;
+  const uint64_t expected_size = (NULL == this->IMAGE) ? 0 : this->IMAGE_SIZE;
+  const char *error = "MOS6502: Snapshot is truncated\n";
+
+  ok = ok && replay_read(stream, &window_count, sizeof(window_count));
+
+  if (ok && window_count != this->WINDOW_COUNT) {
+    fprintf(stderr, "MOS6502: Snapshot has %u bank windows, CPU has %u\n",
+            window_count, this->WINDOW_COUNT);
+    ok = 0;
+    error = NULL;
+  }
+
+  for (uint8_t index = 0; ok && index < window_count; ++index) {
+    ok = replay_read(stream, &banks[index], sizeof(banks[index]));
+
+    if (ok && this->IMAGE_SIZE < ((size_t)banks[index] + 1) *
+                                     this->WINDOWS[index].size) {
+      fprintf(stderr, "MOS6502: Snapshot bank %u does not fit the image\n",
+              banks[index]);
+      ok = 0;
+      error = NULL;
+    }
+  }
+
+  ok = ok && replay_read(stream, &image_size, sizeof(image_size));
+
+  if (ok && image_size != expected_size) {
+    fprintf(stderr, "MOS6502: Snapshot image size does not match the CPU\n");
+    ok = 0;
+    error = NULL;
+  }
+
+  if (ok && 0 < image_size) {
+    image = (uint8_t *)malloc(image_size);
+    ok = NULL != image && replay_read(stream, image, image_size);
+  }
+
+  if (!ok) {
+    if (NULL != error) {
+      fprintf(stderr, "%s", error);
+    }
+
+    free(bus);
+    free(image);
+    return 0;
+  }
+
+  this->PC = pc;
+  this->A = a;
+  this->X = x;
+  this->Y = y;
+  this->P = p;
+  this->SP = sp;
+  this->STATE = state;
+  this->CYCLES = cycles;
+
+  memcpy(this->BUS, bus, MOS6502_BUS_SIZE);
+
+  if (0 < image_size) {
+    memcpy(this->IMAGE, image, image_size);
+  }
+
+  for (uint8_t index = 0; index < window_count; ++index) {
+    mos6502_select_bank(this, index, banks[index]);
+  }
+
+  free(bus);
+  free(image);
+
+  /* Waiting is only an instruction to retry, and queued input is not state:
+   * replay feeds the ports again from the log. */
+  if (MOS6502_STATE_WAITING == this->STATE) {
+    this->STATE = MOS6502_STATE_RUNNING;
+  }
+
+  this->TRAPPED = 0;
+  this->STARVED = 0;
+
+  for (uint8_t index = 0; index < this->PORT_COUNT; ++index) {
+    this->PORTS[index].head = 0;
+    this->PORTS[index].count = 0;
+  }
+
+  return 1;
+}
+
+static void replay_put_varint(FILE *stream, uint64_t value) {
+  while (0x80 <= value) {
+    fputc((int)((value & 0x7F) | 0x80), stream);
+    value >>= 7;
+  }
+
+  fputc((int)value, stream);
+}
+
+static int replay_get_varint(FILE *stream, uint64_t *value) {
+  *value = 0;
+
+  for (uint8_t shift = 0; shift < 64; shift += 7) {
+    const int byte = fgetc(stream);
+
+    if (EOF == byte) {
+      return 0;
+    }
+
+    *value |= (uint64_t)(byte & 0x7F) << shift;
+
+    if (!(byte & 0x80)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Each event is its kind, the cycles elapsed since the previous event as a
+ * varint and, for port reads, the address and value: two bytes for a
+ * nearby interrupt, five or more for a port read.
+ */
+void mos6502_record_event(MOS6502 *this, const uint8_t kind,
+                          const uint16_t address, const uint8_t value) {
+  fputc(kind, this->RECORD);
+  replay_put_varint(this->RECORD, this->CYCLES - this->RECORD_CYCLE);
+
+  if (MOS6502_EVENT_PORT == kind) {
+    fputc(address & 0xFF, this->RECORD);
+    fputc(address >> 8, this->RECORD);
+    fputc(value, this->RECORD);
+  }
+
+  this->RECORD_CYCLE = this->CYCLES;
+}
+
+static void replay_next(MOS6502 *this) {
+  MOS6502_Event *event = &this->REPLAY_EVENT;
+
+  const int kind = fgetc(this->REPLAY);
+
+  if (EOF == kind) {
+    fprintf(stdout, "MOS6502: Replay finished at cycle %llu\n",
+            (unsigned long long)this->CYCLES);
+
+    this->REPLAY = NULL;
+    return;
+  }
+
+  uint64_t delta = 0;
+  int ok = replay_get_varint(this->REPLAY, &delta);
+
+  event->kind = (uint8_t)kind;
+  event->cycle = this->REPLAY_CYCLE + delta;
+  event->address = 0;
+  event->value = 0;
+
+  if (ok && MOS6502_EVENT_PORT == kind) {
+    const int low = fgetc(this->REPLAY);
+    const int high = fgetc(this->REPLAY);
+    const int value = fgetc(this->REPLAY);
+
+    ok = EOF != low && EOF != high && EOF != value;
+
+    event->address = (uint16_t)(low | (high << 8));
+    event->value = (uint8_t)value;
+  }
+
+  if (!ok || MOS6502_EVENT_PORT > kind || MOS6502_EVENT_NMI < kind) {
+    fprintf(stderr, "MOS6502: Replay log is corrupt, going live\n");
+
+    this->REPLAY = NULL;
+    return;
+  }
+
+  this->REPLAY_CYCLE = event->cycle;
+}
+
+void mos6502_record(MOS6502 *this, FILE *stream) {
+  this->RECORD = stream;
+  this->RECORD_CYCLE = this->CYCLES;
+}
+
+void mos6502_replay(MOS6502 *this, FILE *stream) {
+  this->REPLAY = stream;
+  this->REPLAY_CYCLE = this->CYCLES;
+
+  if (NULL != stream) {
+    replay_next(this);
+  }
+}
+
+int mos6502_replay_port(MOS6502 *this, const uint16_t address,
+                        uint8_t *value) {
+  const MOS6502_Event event = this->REPLAY_EVENT;
+
+  if (MOS6502_EVENT_PORT != event.kind || event.address != address ||
+      event.cycle != this->CYCLES) {
+    fprintf(stderr,
+            "MOS6502: Replay diverged reading '0x%04X' at cycle %llu, going "
+            "live\n",
+            address, (unsigned long long)this->CYCLES);
+
+    this->REPLAY = NULL;
+    return 0;
+  }
+
+  *value = event.value;
+
+  replay_next(this);
+
+  return 1;
+}
+
+uint8_t mos6502_replay_interrupt(MOS6502 *this) {
+  const MOS6502_Event event = this->REPLAY_EVENT;
+
+  if (NULL == this->REPLAY || MOS6502_EVENT_PORT == event.kind ||
+      this->CYCLES < event.cycle) {
+    return 0;
+  }
+
+  /* Interrupts land on instruction boundaries, so stepping over the recorded
+   * cycle means the run took a different path. */
+  if (this->CYCLES > event.cycle) {
+    fprintf(stderr,
+            "MOS6502: Replay diverged, interrupt due at cycle %llu reached at "
+            "cycle %llu, going live\n",
+            (unsigned long long)event.cycle, (unsigned long long)this->CYCLES);
+
+    this->REPLAY = NULL;
+    return 0;
+  }
+
+  replay_next(this);
+
+  return event.kind;
+}
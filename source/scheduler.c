@@ -0,0 +1,75 @@
+#include "scheduler.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+MOS6502_Scheduler *mos6502_scheduler_construct(const uint64_t quantum) {
+  MOS6502_Scheduler *this =
+      (MOS6502_Scheduler *)malloc(sizeof(MOS6502_Scheduler));
+
+  if (NULL == this) {
+    return NULL;
+  }
+
+  memset(this, 0, sizeof(MOS6502_Scheduler));
+
+  this->QUANTUM = quantum;
+
+  return this;
+}
+
+void mos6502_scheduler_destruct(MOS6502_Scheduler *this) {
+  assert(NULL != this);
+
+  free(this->CPUS);
+
+  free(this);
+}
+
+int mos6502_scheduler_add(MOS6502_Scheduler *this, MOS6502 *cpu) {
+  if (this->COUNT == this->CAPACITY) {
+    const size_t capacity = (0 == this->CAPACITY) ? 16 : this->CAPACITY * 2;
+
+    MOS6502 **cpus =
+        (MOS6502 **)realloc(this->CPUS, capacity * sizeof(MOS6502 *));
+
+    if (NULL == cpus) {
+      fprintf(stderr, "MOS6502: Scheduler could not grow to %zu CPUs\n",
+              capacity);
+      return 0;
+    }
+
+    this->CPUS = cpus;
+    this->CAPACITY = capacity;
+  }
+
+  this->CPUS[this->COUNT++] = cpu;
+
+  return 1;
+}
+
+/*
+ * Gives every runnable CPU one quantum, in order, and returns how many ran.
+ * Zero means all of them are paused or waiting on input, so the host loop can
+ * block until it has something to feed.
+ */
+size_t mos6502_scheduler_run(MOS6502_Scheduler *this) {
+  size_t ran = 0;
+
+  for (size_t index = 0; index < this->COUNT; ++index) {
+    MOS6502 *cpu = this->CPUS[index];
+
+    if (MOS6502_STATE_RUNNING != cpu->STATE) {
+      continue;
+    }
+
+    mos6502_run(cpu, this->QUANTUM);
+
+    ++ran;
+  }
+
+  return ran;
+}
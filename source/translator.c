@@ -0,0 +1,614 @@
+#include "translator.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRANSLATOR_DECODED 0x01
+#define TRANSLATOR_LEADER 0x02
+#define TRANSLATOR_QUEUED 0x04
+
+#define TRANSLATOR_SEGMENT_GAP 8
+
+static uint8_t translator_peek(const MOS6502 *this, const uint16_t address) {
+  return this->PAGES[address >> 8][address & 0xFF];
+}
+
+static uint16_t translator_peek_word(const MOS6502 *this,
+                                     const uint16_t address) {
+  return translator_peek(this, address) |
+         ((uint16_t)translator_peek(this, address + 1) << 8);
+}
+
+static uint8_t translator_length(const uint8_t opcode) {
+  switch (opcode) {
+    case MOS6502_LDX_IMMEDIATE_MODE:
+    case MOS6502_BEQ_RELATIVE_MODE:
+    case MOS6502_ADC_IMMEDIATE_MODE:
+    case MOS6502_SBC_IMMEDIATE_MODE:
+      return 2;
+    case MOS6502_LDA_ABSOLUTE_X_MODE:
+    case MOS6502_STA_ABSOLUTE_MODE:
+    case MOS6502_JMP_ABSOLUTE_MODE:
+      return 3;
+    case MOS6502_INX_IMPLIED_MODE:
+    case MOS6502_BRK_IMPLIED_MODE:
+    case MOS6502_CLC_IMPLIED_MODE:
+    case MOS6502_SEC_IMPLIED_MODE:
+    case MOS6502_CLD_IMPLIED_MODE:
+    case MOS6502_SED_IMPLIED_MODE:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static int translator_falls_through(const uint8_t opcode) {
+  switch (opcode) {
+    case MOS6502_LDX_IMMEDIATE_MODE:
+    case MOS6502_LDA_ABSOLUTE_X_MODE:
+    case MOS6502_BEQ_RELATIVE_MODE:
+    case MOS6502_STA_ABSOLUTE_MODE:
+    case MOS6502_INX_IMPLIED_MODE:
+    case MOS6502_ADC_IMMEDIATE_MODE:
+    case MOS6502_SBC_IMMEDIATE_MODE:
+    case MOS6502_CLC_IMPLIED_MODE:
+    case MOS6502_SEC_IMPLIED_MODE:
+    case MOS6502_CLD_IMPLIED_MODE:
+    case MOS6502_SED_IMPLIED_MODE:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Unknown opcodes, data mostly, are left to the interpreter, and so is code in
+ * bank windows: the bytes there change whenever the program switches banks.
+ * So are instructions split across two pages, as the guard in front of each
+ * instruction only checks the page it starts on.
+ */
+static int translator_decodable(const MOS6502 *this, const uint16_t address) {
+  const uint8_t length = translator_length(translator_peek(this, address));
+  const uint16_t last = address + length - 1;
+
+  return 0 != length && (address >> 8) == (last >> 8) &&
+         mos6502_find_window(this, address) < 0;
+}
+
+static void translator_queue(uint8_t *marks, uint16_t *pending,
+                             size_t *pending_count, const uint16_t address) {
+  marks[address] |= TRANSLATOR_LEADER;
+
+  if (marks[address] & TRANSLATOR_QUEUED) {
+    return;
+  }
+
+  marks[address] |= TRANSLATOR_QUEUED;
+  pending[(*pending_count)++] = address;
+}
+
+static void translator_mark_fall_through(const MOS6502 *this, uint8_t *marks,
+                                         const uint16_t address,
+                                         const uint32_t following) {
+  const uint8_t opcode = translator_peek(this, address);
+  const uint16_t next = address + translator_length(opcode);
+
+  if (translator_falls_through(opcode) && next != following) {
+    marks[next] |= TRANSLATOR_LEADER;
+  }
+}
+
+/*
+ * Follows control flow from every entry point, marking each decoded
+ * instruction and the leaders that start a basic block: entry points, branch
+ * and jump targets, and fall-throughs that are not laid out next in memory.
+ */
+static void translator_discover(const MOS6502 *this, uint8_t *marks,
+                                uint16_t *pending, const uint16_t *entries,
+                                const size_t entry_count) {
+  size_t pending_count = 0;
+
+  for (size_t index = 0; index < entry_count; ++index) {
+    translator_queue(marks, pending, &pending_count, entries[index]);
+  }
+
+  while (0 < pending_count) {
+    uint16_t address = pending[--pending_count];
+
+    while (!(marks[address] & TRANSLATOR_DECODED) &&
+           translator_decodable(this, address)) {
+      marks[address] |= TRANSLATOR_DECODED;
+
+      const uint8_t opcode = translator_peek(this, address);
+      const uint8_t length = translator_length(opcode);
+
+      if (MOS6502_BEQ_RELATIVE_MODE == opcode) {
+        const int8_t offset = (int8_t)translator_peek(this, address + 1);
+
+        translator_queue(marks, pending, &pending_count,
+                         (uint16_t)(address + 2 + offset));
+        translator_queue(marks, pending, &pending_count,
+                         (uint16_t)(address + 2));
+        break;
+      }
+
+      if (MOS6502_JMP_ABSOLUTE_MODE == opcode) {
+        translator_queue(marks, pending, &pending_count,
+                         translator_peek_word(this, address + 1));
+        break;
+      }
+
+      if (!translator_falls_through(opcode)) {
+        break;
+      }
+
+      address += length;
+    }
+  }
+
+  uint32_t previous = MOS6502_BUS_SIZE;
+
+  for (uint32_t address = 0; address < MOS6502_BUS_SIZE; ++address) {
+    if (!(marks[address] & TRANSLATOR_DECODED)) {
+      continue;
+    }
+
+    if (MOS6502_BUS_SIZE != previous) {
+      translator_mark_fall_through(this, marks, previous, address);
+    }
+
+    previous = address;
+  }
+
+  if (MOS6502_BUS_SIZE != previous) {
+    translator_mark_fall_through(this, marks, previous, MOS6502_BUS_SIZE);
+  }
+}
+
+/* Banked pages are loaded into the image instead, see translator_emit_load. */
+static uint8_t translator_bus_byte(const MOS6502 *this, const size_t address) {
+  if (0 <= mos6502_find_window(this, (uint16_t)address)) {
+    return 0;
+  }
+
+  return translator_peek(this, (uint16_t)address);
+}
+
+static uint8_t translator_image_byte(const MOS6502 *this,
+                                     const size_t offset) {
+  return this->IMAGE[offset];
+}
+
+typedef uint8_t (*translator_source)(const MOS6502 *, const size_t);
+
+/*
+ * Calls emit for every run of non-zero bytes, merging runs split by only a
+ * few zeros so operands like #$00 do not fragment the image.
+ */
+static void translator_for_each_segment(
+    const MOS6502 *this, const char *name, FILE *stream,
+    const translator_source source, const size_t size, const char *kind,
+    void (*emit)(const MOS6502 *, const char *, FILE *,
+                 const translator_source, const char *, const size_t,
+                 const size_t)) {
+  size_t address = 0;
+
+  while (address < size) {
+    if (0 == source(this, address)) {
+      ++address;
+      continue;
+    }
+
+    size_t end = address;
+    size_t zeros = 0;
+
+    while (end < size && zeros <= TRANSLATOR_SEGMENT_GAP) {
+      zeros = (0 == source(this, end)) ? zeros + 1 : 0;
+      ++end;
+    }
+
+    end -= zeros;
+
+    emit(this, name, stream, source, kind, address, end);
+
+    address = end;
+  }
+}
+
+static void translator_emit_segment_bytes(const MOS6502 *this,
+                                          const char *name, FILE *stream,
+                                          const translator_source source,
+                                          const char *kind,
+                                          const size_t address,
+                                          const size_t end) {
+  fprintf(stream, "static const uint8_t %s_%s_%04zX[] = {", name, kind,
+          address);
+
+  for (size_t index = address; index < end; ++index) {
+    fprintf(stream, "%s0x%02X", (0 == (index - address) % 12) ? "\n    " : " ",
+            source(this, index));
+
+    if (index + 1 < end) {
+      fprintf(stream, ",");
+    }
+  }
+
+  fprintf(stream, "\n};\n\n");
+}
+
+static void translator_emit_segment_entry(const MOS6502 *this,
+                                          const char *name, FILE *stream,
+                                          const translator_source source,
+                                          const char *kind,
+                                          const size_t address,
+                                          const size_t end) {
+  (void)this;
+  (void)source;
+
+  fprintf(stream, "      {0x%04zX, %zu, %s_%s_%04zX},\n", address,
+          end - address, name, kind, address);
+}
+
+/*
+ * NAME_load writes the unbanked pages straight into the address space. With
+ * bank windows, the image goes into the CPU's own image, which has to be set
+ * with mos6502_set_image first, and the windows are mapped over it again.
+ */
+static void translator_emit_load(const MOS6502 *this, const char *name,
+                                 FILE *stream) {
+  const size_t image_size =
+      (0 < this->WINDOW_COUNT && NULL != this->IMAGE) ? this->IMAGE_SIZE : 0;
+
+  translator_for_each_segment(this, name, stream, translator_bus_byte,
+                              MOS6502_BUS_SIZE, "SEGMENT",
+                              translator_emit_segment_bytes);
+  translator_for_each_segment(this, name, stream, translator_image_byte,
+                              image_size, "BANKED",
+                              translator_emit_segment_bytes);
+
+  fprintf(stream,
+          "void %s_load(MOS6502 *this) {\n"
+          "  static const Segment SEGMENTS[] = {\n",
+          name);
+
+  translator_for_each_segment(this, name, stream, translator_bus_byte,
+                              MOS6502_BUS_SIZE, "SEGMENT",
+                              translator_emit_segment_entry);
+
+  fprintf(stream,
+          "      {0x0000, 0, NULL},\n"
+          "  };\n"
+          "\n"
+          "  for (size_t index = 0; NULL != SEGMENTS[index].bytes; ++index) {\n"
+          "    for (uint32_t offset = 0; offset < SEGMENTS[index].length; "
+          "++offset) {\n"
+          "      const uint16_t address = SEGMENTS[index].address + offset;\n"
+          "\n"
+          "      this->PAGES[address >> 8][address & 0xFF] =\n"
+          "          SEGMENTS[index].bytes[offset];\n"
+          "    }\n"
+          "  }\n");
+
+  if (0 == this->WINDOW_COUNT) {
+    fprintf(stream, "}\n\n");
+    return;
+  }
+
+  fprintf(stream,
+          "\n"
+          "  static const Segment BANKED[] = {\n");
+
+  translator_for_each_segment(this, name, stream, translator_image_byte,
+                              image_size, "BANKED",
+                              translator_emit_segment_entry);
+
+  fprintf(stream,
+          "      {0x0000, 0, NULL},\n"
+          "  };\n"
+          "\n"
+          "  if (NULL == this->IMAGE) {\n"
+          "    return;\n"
+          "  }\n"
+          "\n"
+          "  for (size_t index = 0; NULL != BANKED[index].bytes; ++index) {\n"
+          "    for (uint32_t offset = 0; offset < BANKED[index].length &&\n"
+          "                              BANKED[index].address + offset <\n"
+          "                                  this->IMAGE_SIZE;\n"
+          "         ++offset) {\n"
+          "      this->IMAGE[BANKED[index].address + offset] =\n"
+          "          BANKED[index].bytes[offset];\n"
+          "    }\n"
+          "  }\n");
+
+  for (uint8_t index = 0; index < this->WINDOW_COUNT; ++index) {
+    const MOS6502_Window window = this->WINDOWS[index];
+
+    fprintf(stream,
+            "\n"
+            "  if (mos6502_find_window(this, 0x%04X) < 0) {\n"
+            "    mos6502_add_window(this, 0x%04X, 0x%04X, 0x%04X);\n"
+            "  }\n"
+            "\n"
+            "  mos6502_select_bank(this, "
+            "(uint8_t)mos6502_find_window(this, 0x%04X), %u);\n",
+            window.base, window.base, window.size, window.control,
+            window.base, window.bank);
+  }
+
+  fprintf(stream, "}\n\n");
+}
+
+/* Jumps to the block at target, or through dispatch when it was not
+ * translated. */
+static void translator_emit_goto(const uint8_t *marks, const uint16_t target,
+                                 const char *indent, FILE *stream) {
+  if (marks[target] & TRANSLATOR_DECODED) {
+    fprintf(stream, "%sgoto i_%04X;\n", indent, target);
+    return;
+  }
+
+  fprintf(stream,
+          "%sthis->PC = 0x%04X;\n"
+          "%sgoto dispatch;\n",
+          indent, target, indent);
+}
+
+static void translator_emit_instruction(const MOS6502 *this,
+                                        const uint8_t *marks,
+                                        const uint16_t address,
+                                        const uint32_t following,
+                                        FILE *stream) {
+  const uint8_t opcode = translator_peek(this, address);
+  const uint8_t operand = translator_peek(this, address + 1);
+  const uint16_t word = translator_peek_word(this, address + 1);
+
+  fprintf(stream, "\n");
+
+  if (marks[address] & TRANSLATOR_LEADER) {
+    fprintf(stream, "i_%04X:\n", address);
+  }
+
+  fprintf(stream,
+          "  if (limit <= this->CYCLES || MOS6502_STATE_RUNNING != this->STATE "
+          "||\n"
+          "      (this->PAGE_FLAGS[0x%02X] &\n"
+          "       (MOS6502_TRAP_EXECUTE | MOS6502_TRAP_READ))) {\n",
+          address >> 8);
+  fprintf(stream,
+          "    this->PC = 0x%04X;\n"
+          "    goto dispatch;\n"
+          "  }\n",
+          address);
+
+  switch (opcode) {
+    case MOS6502_LDX_IMMEDIATE_MODE:
+      fprintf(stream,
+              "  /* LDX #$%02X */\n"
+              "  this->X = 0x%02X;\n"
+              "  set_z_n(this, 0x%02X);\n"
+              "  this->CYCLES += 2;\n",
+              operand, operand, operand);
+      break;
+    case MOS6502_LDA_ABSOLUTE_X_MODE:
+      fprintf(stream,
+              "  /* LDA $%04X,X */\n"
+              "  {\n"
+              "    const uint16_t address = (uint16_t)(0x%04X + this->X);\n"
+              "    uint8_t value = this->PAGES[address >> 8][address & 0xFF];\n"
+              "\n"
+              "    if (this->PAGE_FLAGS[address >> 8]) {\n"
+              "      this->PC = 0x%04X;\n"
+              "      value = mos6502_read(this, address);\n"
+              "\n"
+              "      if (this->STARVED) {\n"
+              "        this->PC = 0x%04X;\n"
+              "        goto dispatch;\n"
+              "      }\n"
+              "    }\n"
+              "\n"
+              "    this->A = value;\n"
+              "    set_z_n(this, value);\n"
+              "    this->CYCLES += 4 + ((address & 0xFF00) != 0x%04X);\n"
+              "  }\n",
+              word, word, address, address, word & 0xFF00);
+      break;
+    case MOS6502_BEQ_RELATIVE_MODE: {
+      const uint16_t next = address + 2;
+      const uint16_t target = next + (int8_t)operand;
+
+      fprintf(stream,
+              "  /* BEQ $%04X */\n"
+              "  this->CYCLES += 2;\n"
+              "\n"
+              "  if (this->P & MOS6502_STATUS_Z) {\n"
+              "    this->CYCLES += %d;\n",
+              target, ((next & 0xFF00) != (target & 0xFF00)) ? 2 : 1);
+      translator_emit_goto(marks, target, "    ", stream);
+      fprintf(stream, "  }\n");
+      break;
+    }
+    case MOS6502_STA_ABSOLUTE_MODE:
+      fprintf(stream,
+              "  /* STA $%04X */\n"
+              "  if (this->PAGE_FLAGS[0x%02X]) {\n"
+              "    this->PC = 0x%04X;\n"
+              "    mos6502_write(this, 0x%04X, this->A);\n"
+              "  } else {\n"
+              "    this->PAGES[0x%02X][0x%02X] = this->A;\n"
+              "  }\n"
+              "\n"
+              "  this->CYCLES += 4;\n",
+              word, word >> 8, address, word, word >> 8, word & 0xFF);
+      break;
+    case MOS6502_INX_IMPLIED_MODE:
+      fprintf(stream,
+              "  /* INX */\n"
+              "  ++this->X;\n"
+              "  set_z_n(this, this->X);\n"
+              "  this->CYCLES += 2;\n");
+      break;
+    case MOS6502_ADC_IMMEDIATE_MODE:
+    case MOS6502_SBC_IMMEDIATE_MODE:
+      fprintf(stream,
+              "  /* %s #$%02X */\n"
+              "  mos6502_%s(this, 0x%02X);\n"
+              "  this->CYCLES += 2;\n",
+              (MOS6502_ADC_IMMEDIATE_MODE == opcode) ? "ADC" : "SBC", operand,
+              (MOS6502_ADC_IMMEDIATE_MODE == opcode) ? "adc" : "sbc", operand);
+      break;
+    case MOS6502_CLC_IMPLIED_MODE:
+    case MOS6502_SEC_IMPLIED_MODE:
+    case MOS6502_CLD_IMPLIED_MODE:
+    case MOS6502_SED_IMPLIED_MODE: {
+      const int decimal = MOS6502_CLD_IMPLIED_MODE == opcode ||
+                          MOS6502_SED_IMPLIED_MODE == opcode;
+      const int set = MOS6502_SEC_IMPLIED_MODE == opcode ||
+                      MOS6502_SED_IMPLIED_MODE == opcode;
+      const char *flag = decimal ? "MOS6502_STATUS_D" : "MOS6502_STATUS_C";
+
+      fprintf(stream,
+              "  /* %s%s */\n"
+              "  this->P %s %s%s;\n"
+              "  this->CYCLES += 2;\n",
+              set ? "SE" : "CL", decimal ? "D" : "C", set ? "|=" : "&=",
+              set ? "" : "(uint8_t)~", flag);
+      break;
+    }
+    case MOS6502_JMP_ABSOLUTE_MODE:
+      fprintf(stream,
+              "  /* JMP $%04X */\n"
+              "  this->CYCLES += 3;\n",
+              word);
+      translator_emit_goto(marks, word, "  ", stream);
+      break;
+    default:
+      fprintf(stream,
+              "  /* 0x%02X is left to the interpreter */\n"
+              "  this->PC = 0x%04X;\n"
+              "  mos6502_execute(this);\n"
+              "  goto dispatch;\n",
+              opcode, address);
+      break;
+  }
+
+  if (translator_falls_through(opcode)) {
+    const uint16_t next = address + translator_length(opcode);
+
+    if (next != following) {
+      translator_emit_goto(marks, next, "  ", stream);
+    }
+  }
+}
+
+int mos6502_translate(const MOS6502 *this, const uint16_t *entries,
+                      const size_t entry_count, const char *name,
+                      FILE *stream) {
+  uint8_t *marks = (uint8_t *)calloc(MOS6502_BUS_SIZE, sizeof(uint8_t));
+  uint16_t *pending = (uint16_t *)malloc(MOS6502_BUS_SIZE * sizeof(uint16_t));
+
+  if (NULL == marks || NULL == pending) {
+    fprintf(stderr, "MOS6502: Translator could not allocate its tables\n");
+
+    free(marks);
+    free(pending);
+    return 0;
+  }
+
+  translator_discover(this, marks, pending, entries, entry_count);
+
+  fprintf(stream,
+          "/* Translated by mos6502 from an assembled image. Do not edit. */\n"
+          "\n"
+          "#include <stddef.h>\n"
+          "#include <stdint.h>\n"
+          "\n"
+          "#include \"mos6502.h\"\n"
+          "\n"
+          "void %s_load(MOS6502 *);\n"
+          "\n"
+          "uint8_t %s_run(MOS6502 *, const uint64_t);\n"
+          "\n"
+          "typedef struct {\n"
+          "  uint32_t address;\n"
+          "  uint32_t length;\n"
+          "  const uint8_t *bytes;\n"
+          "} Segment;\n"
+          "\n"
+          "static inline void set_z_n(MOS6502 *this, const uint8_t value) {\n"
+          "  this->P = (this->P & ~(MOS6502_STATUS_Z | MOS6502_STATUS_N)) |\n"
+          "            (value ? 0 : MOS6502_STATUS_Z) | (value & "
+          "MOS6502_STATUS_N);\n"
+          "}\n"
+          "\n",
+          name, name);
+
+  translator_emit_load(this, name, stream);
+
+  fprintf(stream,
+          "uint8_t %s_run(MOS6502 *this, const uint64_t cycles) {\n"
+          "  const uint64_t limit = this->CYCLES + cycles;\n"
+          "\n"
+          "dispatch:\n"
+          "  if (MOS6502_STATE_RUNNING != this->STATE || limit <= "
+          "this->CYCLES) {\n"
+          "    return this->STATE;\n"
+          "  }\n"
+          "\n"
+          "  /* Replays deliver interrupts between instructions, so they run\n"
+          "   * on the interpreter. Translated code only runs on pages without\n"
+          "   * breakpoints or read watchpoints, as it fetches nothing through\n"
+          "   * mos6502_read, so a breakpoint stepped over is behind us once we\n"
+          "   * get there, and nothing in there can set TRAPPED again. */\n"
+          "  if (NULL == this->REPLAY &&\n"
+          "      !(this->PAGE_FLAGS[this->PC >> 8] &\n"
+          "        (MOS6502_TRAP_EXECUTE | MOS6502_TRAP_READ))) {\n"
+          "    this->TRAPPED = 0;\n"
+          "\n"
+          "    switch (this->PC) {\n",
+          name);
+
+  for (uint32_t address = 0; address < MOS6502_BUS_SIZE; ++address) {
+    if ((marks[address] & TRANSLATOR_LEADER) &&
+        (marks[address] & TRANSLATOR_DECODED)) {
+      fprintf(stream, "      case 0x%04X:\n        goto i_%04X;\n", address,
+              address);
+    }
+  }
+
+  fprintf(stream,
+          "      default:\n"
+          "        break;\n"
+          "    }\n"
+          "  }\n"
+          "\n"
+          "  mos6502_execute(this);\n"
+          "  goto dispatch;\n");
+
+  uint32_t previous = MOS6502_BUS_SIZE;
+
+  for (uint32_t address = 0; address < MOS6502_BUS_SIZE; ++address) {
+    if (!(marks[address] & TRANSLATOR_DECODED)) {
+      continue;
+    }
+
+    if (MOS6502_BUS_SIZE != previous) {
+      translator_emit_instruction(this, marks, previous, address, stream);
+    }
+
+    previous = address;
+  }
+
+  if (MOS6502_BUS_SIZE != previous) {
+    translator_emit_instruction(this, marks, previous, MOS6502_BUS_SIZE,
+                                stream);
+  }
+
+  fprintf(stream, "}\n");
+
+  free(marks);
+  free(pending);
+
+  return 0 == ferror(stream);
+}
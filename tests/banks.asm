@@ -0,0 +1,27 @@
+// Code in a bank window that switches banks under itself, translated at
+// build time
+.WINDOW $8000, $2000, $FFF0
+
+.ORG $0300
+
+START:
+    STA $FFF0
+    JMP SWITCH
+
+.BANK 0
+.ORG $8000
+
+SWITCH:
+    INX
+    CLC
+    ADC #$01
+    STA $FFF0
+    INX
+    BRK
+
+.BANK 1
+.ORG $8007
+    INX
+    INX
+    INX
+    BRK
@@ -0,0 +1,26 @@
+// Every mnemonic and directive once, ending without a newline
+.WINDOW $8000, $2000, $FFF0
+
+.ORG $0300
+
+START_1:
+    LDX #$02
+    LDA TEXT_2,X
+    BEQ START_1
+    STA $0200
+    INX
+    ADC #$01
+    SBC #1
+    CLC
+    SEC
+    CLD
+    SED
+    JMP START_1
+    BRK
+
+TEXT_2:
+    .BYTE "A B", $00
+
+.BANK 1
+.ORG $8000
+    .BYTE $42
\ No newline at end of file
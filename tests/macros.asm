@@ -0,0 +1,16 @@
+// Macro directives followed by comments, translated at build time
+.MACRO NEXT // X + 1
+    INX
+.ENDM // NEXT
+
+.MACRO AGAIN ; X + 1
+    INX
+.ENDM ; AGAIN
+
+.ORG $0300
+
+START:
+    LDX #$00
+    NEXT
+    AGAIN
+    BRK
@@ -1,9 +1,40 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
 #include "mos6502.h"
+#include "replay.h"
+#include "scheduler.h"
+#include "translator.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <unity.h>
 
 typedef void (*test_t)(void);
 
+/* Translated from 6502.asm at build time, see CMakeLists.txt. */
+void hello_world_load(MOS6502 *);
+
+uint8_t hello_world_run(MOS6502 *, const uint64_t);
+
+/* Translated from tests/macros.asm at build time. */
+void macros_load(MOS6502 *);
+
+/* Translated from tests/banks.asm at build time. */
+void banks_load(MOS6502 *);
+
+uint8_t banks_run(MOS6502 *, const uint64_t);
+
+/* Assembled from tests/windows.asm at build time. */
+void windows_load(MOS6502 *);
+
+/* Assembled from tests/keywords.asm, which lacks a trailing newline. */
+void keywords_load(MOS6502 *);
+
+/* Assembled from the empty tests/empty.asm. */
+void empty_load(MOS6502 *);
+
 static MOS6502 *CPU = NULL;
 
 void setUp(void) {
@@ -328,6 +359,1200 @@ void test_mos6502_execute_BRK_IMPLIED(void) {
                           CPU->BUS[MOS6502_STACK + 0xFB]);  // P with B flag set
 }
 
+typedef struct {
+  uint8_t kind;
+  uint16_t address;
+  int hits;
+  int pause;
+} trap_log_t;
+
+static int log_trap(MOS6502 *cpu, const uint8_t kind, const uint16_t address,
+                    void *context) {
+  (void)cpu;
+
+  trap_log_t *log = (trap_log_t *)context;
+  log->kind = kind;
+  log->address = address;
+  ++log->hits;
+
+  return log->pause;
+}
+
+void test_mos6502_breakpoint_pauses_and_resumes(void) {
+  CPU->PC = 0x1000;
+  CPU->BUS[0x1000] = MOS6502_INX_IMPLIED_MODE;
+  CPU->X = 0x00;
+
+  TEST_ASSERT_TRUE(mos6502_add_trap(CPU, 0x1000, MOS6502_TRAP_EXECUTE));
+
+  mos6502_execute(CPU);
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, CPU->STATE);
+  TEST_ASSERT_EQUAL_UINT16(0x1000, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT8(0x00, CPU->X);
+
+  mos6502_resume(CPU);
+  mos6502_execute(CPU);
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_RUNNING, CPU->STATE);
+  TEST_ASSERT_EQUAL_UINT16(0x1001, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT8(0x01, CPU->X);
+}
+
+void test_mos6502_write_watchpoint_calls_handler(void) {
+  trap_log_t log = {0};
+
+  CPU->PC = 0x1000;
+  CPU->A = 0x42;
+  CPU->BUS[0x1000] = MOS6502_STA_ABSOLUTE_MODE;
+  CPU->BUS[0x1001] = 0x00;
+  CPU->BUS[0x1002] = 0x30;
+
+  mos6502_set_trap_handler(CPU, log_trap, &log);
+  TEST_ASSERT_TRUE(mos6502_add_trap(CPU, 0x3000, MOS6502_TRAP_WRITE));
+
+  mos6502_execute(CPU);
+
+  TEST_ASSERT_EQUAL_INT(1, log.hits);
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_TRAP_WRITE, log.kind);
+  TEST_ASSERT_EQUAL_UINT16(0x3000, log.address);
+  TEST_ASSERT_EQUAL_UINT8(0x42, CPU->BUS[0x3000]);
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_RUNNING, CPU->STATE);
+}
+
+void test_mos6502_stack_watchpoints_call_handler(void) {
+  trap_log_t log = {0};
+
+  CPU->PC = 0x1000;
+  CPU->SP = 0xFD;
+  CPU->BUS[0x1000] = MOS6502_BRK_IMPLIED_MODE;
+
+  mos6502_set_trap_handler(CPU, log_trap, &log);
+  TEST_ASSERT_TRUE(mos6502_add_trap(CPU, 0x01FC, MOS6502_TRAP_WRITE));
+
+  mos6502_execute(CPU);  // Pushes PC high, PC low to 0x01FC, then P
+
+  TEST_ASSERT_EQUAL_INT(1, log.hits);
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_TRAP_WRITE, log.kind);
+  TEST_ASSERT_EQUAL_UINT16(0x01FC, log.address);
+
+  TEST_ASSERT_TRUE(mos6502_add_trap(CPU, 0x01FB, MOS6502_TRAP_READ));
+
+  mos6502_pop(CPU);
+
+  TEST_ASSERT_EQUAL_INT(2, log.hits);
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_TRAP_READ, log.kind);
+  TEST_ASSERT_EQUAL_UINT16(0x01FB, log.address);
+}
+
+void test_mos6502_read_watchpoint_ignores_other_addresses(void) {
+  trap_log_t log = {.pause = 1};
+
+  mos6502_set_trap_handler(CPU, log_trap, &log);
+  TEST_ASSERT_TRUE(mos6502_add_trap(CPU, 0x2005, MOS6502_TRAP_READ));
+
+  mos6502_read(CPU, 0x2004);
+  mos6502_write(CPU, 0x2005, 0x01);
+
+  TEST_ASSERT_EQUAL_INT(0, log.hits);
+
+  mos6502_read(CPU, 0x2005);
+
+  TEST_ASSERT_EQUAL_INT(1, log.hits);
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, CPU->STATE);
+}
+
+void test_mos6502_read_watchpoint_on_code_makes_progress(void) {
+  CPU->PC = 0x1000;
+  CPU->BUS[0x1000] = MOS6502_INX_IMPLIED_MODE;
+  CPU->BUS[0x1001] = MOS6502_INX_IMPLIED_MODE;
+  CPU->X = 0x00;
+
+  TEST_ASSERT_TRUE(mos6502_add_trap(CPU, 0x1000, MOS6502_TRAP_READ));
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, mos6502_run(CPU, 100));
+  TEST_ASSERT_EQUAL_UINT16(0x1001, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT8(0x01, CPU->X);
+
+  mos6502_resume(CPU);
+  mos6502_run(CPU, 2);
+
+  TEST_ASSERT_EQUAL_UINT16(0x1002, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT8(0x02, CPU->X);
+}
+
+void test_mos6502_remove_trap_clears_page_flags(void) {
+  TEST_ASSERT_TRUE(mos6502_add_trap(CPU, 0x2005, MOS6502_TRAP_READ));
+  TEST_ASSERT_TRUE(mos6502_add_trap(CPU, 0x20F0, MOS6502_TRAP_WRITE));
+
+  mos6502_remove_trap(CPU, 0x2005, MOS6502_TRAP_READ);
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_TRAP_WRITE, CPU->PAGE_FLAGS[0x20]);
+
+  mos6502_remove_trap(CPU, 0x20F0, MOS6502_TRAP_WRITE);
+
+  TEST_ASSERT_EQUAL_UINT8(0x00, CPU->PAGE_FLAGS[0x20]);
+  TEST_ASSERT_EQUAL_UINT8(0, CPU->TRAP_COUNT);
+}
+
+void test_mos6502_run_counts_cycles(void) {
+  CPU->PC = 0x1000;
+  CPU->BUS[0x1000] = MOS6502_JMP_ABSOLUTE_MODE;
+  CPU->BUS[0x1001] = 0x00;
+  CPU->BUS[0x1002] = 0x10;
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_RUNNING, mos6502_run(CPU, 10));
+
+  TEST_ASSERT_EQUAL_UINT64(12, CPU->CYCLES);  // Four JMPs of 3 cycles
+  TEST_ASSERT_EQUAL_UINT16(0x1000, CPU->PC);
+}
+
+void test_mos6502_port_read_waits_and_restarts(void) {
+  CPU->PC = 0x1000;
+  CPU->X = 0x00;
+  CPU->A = 0x11;
+  CPU->BUS[0x1000] = MOS6502_LDA_ABSOLUTE_X_MODE;
+  CPU->BUS[0x1001] = 0x00;
+  CPU->BUS[0x1002] = 0x30;
+
+  TEST_ASSERT_TRUE(mos6502_add_port(CPU, 0x3000));
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_WAITING, mos6502_run(CPU, 100));
+  TEST_ASSERT_EQUAL_UINT16(0x1000, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT8(0x11, CPU->A);
+  TEST_ASSERT_EQUAL_UINT64(0, CPU->CYCLES);
+
+  TEST_ASSERT_TRUE(mos6502_feed(CPU, 0x3000, 0x5A));
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_RUNNING, CPU->STATE);
+
+  mos6502_execute(CPU);
+
+  TEST_ASSERT_EQUAL_UINT8(0x5A, CPU->A);
+  TEST_ASSERT_EQUAL_UINT16(0x1003, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT64(4, CPU->CYCLES);
+}
+
+void test_mos6502_brk_does_not_wait_on_vector_port(void) {
+  CPU->PC = 0x1000;
+  CPU->SP = 0xFD;
+  CPU->BUS[0x1000] = MOS6502_BRK_IMPLIED_MODE;
+  CPU->BUS[MOS6502_VEC_IRQ] = 0x00;
+  CPU->BUS[MOS6502_VEC_IRQ + 1] = 0x20;
+
+  TEST_ASSERT_TRUE(mos6502_add_port(CPU, MOS6502_VEC_IRQ));
+
+  mos6502_execute(CPU);
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_RUNNING, CPU->STATE);
+  TEST_ASSERT_EQUAL_UINT16(0x2000, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT8(0xFA, CPU->SP);  // Pushed once
+}
+
+static void load_port_read(MOS6502 *cpu) {
+  cpu->PC = 0x1000;
+  cpu->X = 0x00;
+  cpu->A = 0x11;
+  cpu->BUS[0x1000] = MOS6502_LDA_ABSOLUTE_X_MODE;
+  cpu->BUS[0x1001] = 0x00;
+  cpu->BUS[0x1002] = 0x30;
+
+  TEST_ASSERT_TRUE(mos6502_add_port(cpu, 0x3000));
+  TEST_ASSERT_TRUE(mos6502_add_trap(cpu, 0x3000, MOS6502_TRAP_READ));
+}
+
+void test_mos6502_port_read_keeps_watchpoint_pause(void) {
+  load_port_read(CPU);
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, mos6502_run(CPU, 100));
+  TEST_ASSERT_EQUAL_UINT16(0x1000, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT8(0x11, CPU->A);
+
+  // Input does not get the CPU past the breakpoint
+  TEST_ASSERT_TRUE(mos6502_feed(CPU, 0x3000, 0x5A));
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, CPU->STATE);
+
+  mos6502_remove_trap(CPU, 0x3000, MOS6502_TRAP_READ);
+  mos6502_resume(CPU);
+  mos6502_execute(CPU);
+
+  TEST_ASSERT_EQUAL_UINT8(0x5A, CPU->A);
+  TEST_ASSERT_EQUAL_UINT16(0x1003, CPU->PC);
+}
+
+void test_mos6502_resume_without_input_keeps_waiting(void) {
+  load_port_read(CPU);
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, mos6502_run(CPU, 100));
+
+  mos6502_resume(CPU);
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_WAITING, CPU->STATE);
+
+  TEST_ASSERT_TRUE(mos6502_feed(CPU, 0x3000, 0x5A));
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_RUNNING, CPU->STATE);
+}
+
+void test_mos6502_feed_rejects_unknown_or_full_port(void) {
+  TEST_ASSERT_FALSE(mos6502_feed(CPU, 0x3000, 0x01));
+
+  TEST_ASSERT_TRUE(mos6502_add_port(CPU, 0x3000));
+
+  for (int index = 0; index < MOS6502_PORT_QUEUE_SIZE; ++index) {
+    TEST_ASSERT_TRUE(mos6502_feed(CPU, 0x3000, (uint8_t)index));
+  }
+
+  TEST_ASSERT_FALSE(mos6502_feed(CPU, 0x3000, 0xFF));
+  TEST_ASSERT_EQUAL_UINT8(0x00, mos6502_read(CPU, 0x3000));
+  TEST_ASSERT_EQUAL_UINT8(0x01, mos6502_read(CPU, 0x3000));
+}
+
+void test_mos6502_scheduler_skips_waiting_cpus(void) {
+  MOS6502 *waiting = mos6502_construct();
+  MOS6502_Scheduler *scheduler = mos6502_scheduler_construct(30);
+
+  TEST_ASSERT_NOT_NULL(waiting);
+  TEST_ASSERT_NOT_NULL(scheduler);
+
+  CPU->PC = 0x1000;
+  CPU->BUS[0x1000] = MOS6502_JMP_ABSOLUTE_MODE;
+  CPU->BUS[0x1001] = 0x00;
+  CPU->BUS[0x1002] = 0x10;
+
+  waiting->PC = 0x1000;
+  waiting->BUS[0x1000] = MOS6502_LDA_ABSOLUTE_X_MODE;
+  waiting->BUS[0x1001] = 0x00;
+  waiting->BUS[0x1002] = 0x30;
+  mos6502_add_port(waiting, 0x3000);
+
+  mos6502_scheduler_add(scheduler, CPU);
+  mos6502_scheduler_add(scheduler, waiting);
+
+  TEST_ASSERT_EQUAL_size_t(2, mos6502_scheduler_run(scheduler));
+  TEST_ASSERT_EQUAL_size_t(1, mos6502_scheduler_run(scheduler));
+  TEST_ASSERT_EQUAL_UINT64(60, CPU->CYCLES);
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_WAITING, waiting->STATE);
+
+  mos6502_feed(waiting, 0x3000, 0x7F);
+
+  TEST_ASSERT_EQUAL_size_t(2, mos6502_scheduler_run(scheduler));
+  TEST_ASSERT_EQUAL_UINT8(0x7F, waiting->A);
+
+  mos6502_scheduler_destruct(scheduler);
+  mos6502_destruct(waiting);
+}
+
+static uint8_t IMAGE[4 * MOS6502_WINDOW_16K];
+
+void test_mos6502_add_window_rejects_bad_geometry(void) {
+  mos6502_set_image(CPU, IMAGE, sizeof(IMAGE));
+
+  TEST_ASSERT_FALSE(mos6502_add_window(CPU, 0x8000, 0x1000, 0xFFF0));
+  TEST_ASSERT_FALSE(mos6502_add_window(CPU, 0x9000, MOS6502_WINDOW_8K, 0xFFF0));
+  TEST_ASSERT_TRUE(mos6502_add_window(CPU, 0x8000, MOS6502_WINDOW_16K, 0xFFF0));
+  TEST_ASSERT_FALSE(mos6502_add_window(CPU, 0xA000, MOS6502_WINDOW_8K, 0xFFF1));
+  TEST_ASSERT_FALSE(mos6502_add_window(CPU, 0xC000, MOS6502_WINDOW_8K, 0xFFF1));
+  TEST_ASSERT_EQUAL_INT(0, mos6502_find_window(CPU, 0xBFFF));
+  TEST_ASSERT_EQUAL_INT(-1, mos6502_find_window(CPU, 0xC000));
+}
+
+void test_mos6502_windows_start_on_their_own_banks(void) {
+  memset(IMAGE, 0, sizeof(IMAGE));
+  IMAGE[0 * MOS6502_WINDOW_8K] = 0xB0;
+  IMAGE[1 * MOS6502_WINDOW_8K] = 0xB1;
+
+  mos6502_set_image(CPU, IMAGE, sizeof(IMAGE));
+  TEST_ASSERT_TRUE(mos6502_add_window(CPU, 0x8000, MOS6502_WINDOW_8K, 0xFFF0));
+  TEST_ASSERT_TRUE(mos6502_add_window(CPU, 0xA000, MOS6502_WINDOW_8K, 0xFFF1));
+
+  TEST_ASSERT_EQUAL_UINT8(0xB0, mos6502_read(CPU, 0x8000));
+  TEST_ASSERT_EQUAL_UINT8(0xB1, mos6502_read(CPU, 0xA000));
+
+  mos6502_write(CPU, 0x8001, 0x5A);
+  TEST_ASSERT_EQUAL_UINT8(0x00, mos6502_read(CPU, 0xA001));
+
+  // The same bank in both windows is the same memory
+  mos6502_write(CPU, 0xFFF1, 0);
+  TEST_ASSERT_EQUAL_UINT8(0x5A, mos6502_read(CPU, 0xA001));
+}
+
+void test_mos6502_add_window_needs_room_for_its_bank(void) {
+  mos6502_set_image(CPU, IMAGE, MOS6502_WINDOW_16K);
+
+  TEST_ASSERT_TRUE(mos6502_add_window(CPU, 0x8000, MOS6502_WINDOW_16K, 0xFFF0));
+  TEST_ASSERT_FALSE(mos6502_add_window(CPU, 0x4000, MOS6502_WINDOW_16K, 0xFFF1));
+  TEST_ASSERT_EQUAL_UINT8(1, CPU->WINDOW_COUNT);
+}
+
+void test_mos6502_control_register_switches_bank(void) {
+  memset(IMAGE, 0, sizeof(IMAGE));
+  IMAGE[0 * MOS6502_WINDOW_8K + 0x0010] = 0xA0;
+  IMAGE[3 * MOS6502_WINDOW_8K + 0x0010] = 0xA3;
+
+  mos6502_set_image(CPU, IMAGE, sizeof(IMAGE));
+  TEST_ASSERT_TRUE(mos6502_add_window(CPU, 0xA000, MOS6502_WINDOW_8K, 0xFFF0));
+
+  TEST_ASSERT_EQUAL_UINT8(0xA0, mos6502_read(CPU, 0xA010));
+
+  mos6502_write(CPU, 0xFFF0, 3);
+
+  TEST_ASSERT_EQUAL_UINT8(0xA3, mos6502_read(CPU, 0xA010));
+  TEST_ASSERT_EQUAL_UINT8(0x00, CPU->BUS[0xFFF0]);
+
+  mos6502_write(CPU, 0xBFFF, 0x5B);
+
+  TEST_ASSERT_EQUAL_UINT8(0x5B, IMAGE[4 * MOS6502_WINDOW_8K - 1]);
+  TEST_ASSERT_EQUAL_UINT8(0x00, CPU->BUS[0xBFFF]);
+}
+
+void test_mos6502_dump_shows_mapped_bank(void) {
+  char output[4096] = {0};
+  FILE *stream = tmpfile();
+  TEST_ASSERT_NOT_NULL(stream);
+
+  memset(IMAGE, 0, sizeof(IMAGE));
+  IMAGE[2 * MOS6502_WINDOW_8K + 0x0010] = 0xB2;
+
+  mos6502_set_image(CPU, IMAGE, sizeof(IMAGE));
+  TEST_ASSERT_TRUE(mos6502_add_window(CPU, 0xA000, MOS6502_WINDOW_8K, 0xFFF0));
+  TEST_ASSERT_TRUE(mos6502_select_bank(CPU, 0, 2));
+
+  mos6502_dump(CPU, stream);
+  rewind(stream);
+  fread(output, 1, sizeof(output) - 1, stream);
+  fclose(stream);
+
+  TEST_ASSERT_NOT_NULL(strstr(output, "ADDRESS 0xA010 B2"));
+  TEST_ASSERT_NULL(strstr(output, "No data in BUS"));
+}
+
+void test_assembler_places_banks_in_the_image(void) {
+  memset(IMAGE, 0, sizeof(IMAGE));
+  mos6502_set_image(CPU, IMAGE, sizeof(IMAGE));
+
+  windows_load(CPU);
+
+  TEST_ASSERT_EQUAL_MEMORY("TWO", &IMAGE[2 * MOS6502_WINDOW_8K], 3);
+  TEST_ASSERT_EQUAL_MEMORY("THREE", &IMAGE[3 * MOS6502_WINDOW_8K], 5);
+  TEST_ASSERT_EQUAL_MEMORY("FOUR", &IMAGE[4 * MOS6502_WINDOW_8K], 4);
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_BRK_IMPLIED_MODE, CPU->BUS[0x0300]);
+  TEST_ASSERT_EQUAL_UINT8(0x00, CPU->BUS[0x8000]);
+
+  // The last window assembled into is left on the last bank
+  TEST_ASSERT_EQUAL_UINT16(4, CPU->WINDOWS[1].bank);
+  TEST_ASSERT_EQUAL_MEMORY("FOUR", CPU->PAGES[0xA0], 4);
+}
+
+void test_assembler_lexes_every_keyword(void) {
+  static const uint8_t PROGRAM[] = {
+      0xA2, 0x02,       // LDX #$02
+      0xBD, 0x17, 0x03, // LDA TEXT_2,X
+      0xF0, 0xF9,       // BEQ START_1
+      0x8D, 0x00, 0x02, // STA $0200
+      0xE8,             // INX
+      0x69, 0x01,       // ADC #$01
+      0xE9, 0x01,       // SBC #1
+      0x18,             // CLC
+      0x38,             // SEC
+      0xD8,             // CLD
+      0xF8,             // SED
+      0x4C, 0x00, 0x03, // JMP START_1
+      0x00,             // BRK
+      'A', ' ', 'B', 0x00,
+  };
+
+  memset(IMAGE, 0, sizeof(IMAGE));
+  mos6502_set_image(CPU, IMAGE, sizeof(IMAGE));
+
+  keywords_load(CPU);
+
+  TEST_ASSERT_EQUAL_MEMORY(PROGRAM, &CPU->BUS[0x0300], sizeof(PROGRAM));
+
+  // The last line has no newline and still reaches the image through .BANK
+  TEST_ASSERT_EQUAL_UINT8(0x42, IMAGE[MOS6502_WINDOW_8K]);
+  TEST_ASSERT_EQUAL_UINT16(0xFFF0, CPU->WINDOWS[0].control);
+}
+
+void test_assembler_accepts_an_empty_file(void) {
+  static const uint8_t EMPTY[0x10000] = {0};
+
+  empty_load(CPU);
+
+  TEST_ASSERT_EQUAL_MEMORY(EMPTY, CPU->BUS, sizeof(EMPTY));
+  TEST_ASSERT_EQUAL_UINT8(0, CPU->WINDOW_COUNT);
+}
+
+void test_mos6502_select_bank_outside_image_fails(void) {
+  mos6502_set_image(CPU, IMAGE, sizeof(IMAGE));
+  TEST_ASSERT_TRUE(mos6502_add_window(CPU, 0x8000, MOS6502_WINDOW_16K, 0xFFF0));
+
+  TEST_ASSERT_TRUE(mos6502_select_bank(CPU, 0, 3));
+  TEST_ASSERT_FALSE(mos6502_select_bank(CPU, 0, 4));
+  TEST_ASSERT_EQUAL_UINT16(3, CPU->WINDOWS[0].bank);
+}
+
+static void assert_same_cpu(const MOS6502 *expected, const MOS6502 *actual) {
+  TEST_ASSERT_EQUAL_UINT16(expected->PC, actual->PC);
+  TEST_ASSERT_EQUAL_UINT8(expected->A, actual->A);
+  TEST_ASSERT_EQUAL_UINT8(expected->X, actual->X);
+  TEST_ASSERT_EQUAL_UINT8(expected->Y, actual->Y);
+  TEST_ASSERT_EQUAL_UINT8(expected->P, actual->P);
+  TEST_ASSERT_EQUAL_UINT8(expected->SP, actual->SP);
+  TEST_ASSERT_EQUAL_UINT8(expected->STATE, actual->STATE);
+  TEST_ASSERT_EQUAL_UINT64(expected->CYCLES, actual->CYCLES);
+  TEST_ASSERT_EQUAL_MEMORY(expected->BUS, actual->BUS, MOS6502_BUS_SIZE);
+}
+
+void test_aot_matches_interpreter(void) {
+  for (uint64_t cycles = 1; cycles < 400; cycles += 7) {
+    MOS6502 *interpreted = mos6502_construct();
+    MOS6502 *native = mos6502_construct();
+    TEST_ASSERT_NOT_NULL(interpreted);
+    TEST_ASSERT_NOT_NULL(native);
+
+    hello_world_load(interpreted);
+    hello_world_load(native);
+    interpreted->PC = native->PC = 0x0300;
+
+    mos6502_run(interpreted, cycles);
+    hello_world_run(native, cycles);
+
+    assert_same_cpu(interpreted, native);
+
+    mos6502_destruct(interpreted);
+    mos6502_destruct(native);
+  }
+}
+
+void test_aot_honours_breakpoints(void) {
+  MOS6502 *native = mos6502_construct();
+  TEST_ASSERT_NOT_NULL(native);
+
+  hello_world_load(CPU);
+  hello_world_load(native);
+  CPU->PC = native->PC = 0x0300;
+
+  mos6502_add_trap(CPU, 0x030A, MOS6502_TRAP_EXECUTE);
+  mos6502_add_trap(native, 0x030A, MOS6502_TRAP_EXECUTE);
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, mos6502_run(CPU, 1000));
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, hello_world_run(native, 1000));
+  assert_same_cpu(CPU, native);
+
+  mos6502_resume(CPU);
+  mos6502_resume(native);
+
+  mos6502_run(CPU, 30);
+  hello_world_run(native, 30);
+  assert_same_cpu(CPU, native);
+
+  mos6502_destruct(native);
+}
+
+void test_aot_honours_read_watchpoints_on_code(void) {
+  MOS6502 *native = mos6502_construct();
+  TEST_ASSERT_NOT_NULL(native);
+
+  hello_world_load(CPU);
+  hello_world_load(native);
+  CPU->PC = native->PC = 0x0300;
+
+  mos6502_add_trap(CPU, 0x030C, MOS6502_TRAP_READ);  // JMP LOOP operand
+  mos6502_add_trap(native, 0x030C, MOS6502_TRAP_READ);
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, mos6502_run(CPU, 1000));
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, hello_world_run(native, 1000));
+  assert_same_cpu(CPU, native);
+
+  mos6502_resume(CPU);
+  mos6502_resume(native);
+
+  mos6502_run(CPU, 30);
+  hello_world_run(native, 30);
+  assert_same_cpu(CPU, native);
+
+  mos6502_destruct(native);
+}
+
+void test_aot_resume_does_not_skip_next_breakpoint(void) {
+  MOS6502 *native = mos6502_construct();
+  TEST_ASSERT_NOT_NULL(native);
+
+  MOS6502 *cpus[2] = {CPU, native};
+
+  for (uint8_t index = 0; index < 2; ++index) {
+    hello_world_load(cpus[index]);
+    cpus[index]->PC = 0x0300;
+    mos6502_add_trap(cpus[index], 0x0302, MOS6502_TRAP_EXECUTE);
+  }
+
+  mos6502_run(CPU, 1000);
+  hello_world_run(native, 1000);
+
+  for (uint8_t index = 0; index < 2; ++index) {
+    mos6502_remove_trap(cpus[index], 0x0302, MOS6502_TRAP_EXECUTE);
+    mos6502_resume(cpus[index]);
+  }
+
+  mos6502_run(CPU, 5);
+  hello_world_run(native, 5);
+
+  for (uint8_t index = 0; index < 2; ++index) {
+    mos6502_add_trap(cpus[index], 0x0307, MOS6502_TRAP_EXECUTE);
+  }
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, mos6502_run(CPU, 1000));
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_PAUSED, hello_world_run(native, 1000));
+  TEST_ASSERT_EQUAL_UINT16(0x0307, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT8(0x00, CPU->X);
+  assert_same_cpu(CPU, native);
+
+  mos6502_destruct(native);
+}
+
+void test_macro_directives_accept_comments(void) {
+  const uint8_t expected[] = {0xA2, 0x00, 0xE8, 0xE8, 0x00};
+
+  macros_load(CPU);
+  TEST_ASSERT_EQUAL_MEMORY(expected, &CPU->BUS[0x0300], sizeof(expected));
+}
+
+static int record_pc(MOS6502 *cpu, const uint8_t kind, const uint16_t address,
+                     void *context) {
+  (void)kind;
+  (void)address;
+
+  *(uint16_t *)context = cpu->PC;
+
+  return 0;
+}
+
+void test_aot_trap_handler_sees_instruction_pc(void) {
+  MOS6502 *native = mos6502_construct();
+  TEST_ASSERT_NOT_NULL(native);
+
+  uint16_t interpreted_pc = 0, native_pc = 0;
+
+  hello_world_load(CPU);
+  hello_world_load(native);
+  CPU->PC = native->PC = 0x0300;
+
+  mos6502_set_trap_handler(CPU, record_pc, &interpreted_pc);
+  mos6502_set_trap_handler(native, record_pc, &native_pc);
+  mos6502_add_trap(CPU, 0xFD00, MOS6502_TRAP_WRITE);
+  mos6502_add_trap(native, 0xFD00, MOS6502_TRAP_WRITE);
+  mos6502_add_trap(CPU, 0x030F, MOS6502_TRAP_READ);
+  mos6502_add_trap(native, 0x030F, MOS6502_TRAP_READ);
+
+  mos6502_run(CPU, 6);  // LDX, LDA from the read trap
+  hello_world_run(native, 6);
+
+  TEST_ASSERT_EQUAL_UINT16(0x0302, interpreted_pc);
+  TEST_ASSERT_EQUAL_UINT16(interpreted_pc, native_pc);
+
+  mos6502_run(CPU, 1000);  // BEQ, STA to the write trap
+  hello_world_run(native, 1000);
+
+  TEST_ASSERT_EQUAL_UINT16(0x0307, interpreted_pc);
+  TEST_ASSERT_EQUAL_UINT16(interpreted_pc, native_pc);
+  assert_same_cpu(CPU, native);
+
+  mos6502_destruct(native);
+}
+
+void test_aot_follows_bank_switch_under_code(void) {
+  static uint8_t images[2][2 * MOS6502_WINDOW_8K];
+
+  for (uint64_t cycles = 1; cycles < 60; cycles += 3) {
+    MOS6502 *interpreted = mos6502_construct();
+    MOS6502 *native = mos6502_construct();
+    TEST_ASSERT_NOT_NULL(interpreted);
+    TEST_ASSERT_NOT_NULL(native);
+
+    memset(images, 0, sizeof(images));
+    mos6502_set_image(interpreted, images[0], sizeof(images[0]));
+    mos6502_set_image(native, images[1], sizeof(images[1]));
+
+    banks_load(interpreted);
+    banks_load(native);
+    interpreted->PC = native->PC = 0x0300;
+
+    mos6502_run(interpreted, cycles);
+    banks_run(native, cycles);
+
+    assert_same_cpu(interpreted, native);
+    TEST_ASSERT_EQUAL_MEMORY(images[0], images[1], sizeof(images[0]));
+
+    if (40 < cycles) {
+      TEST_ASSERT_EQUAL_UINT8(4, native->X);  // Bank 1 ran after the switch
+    }
+
+    mos6502_destruct(interpreted);
+    mos6502_destruct(native);
+  }
+}
+
+static char TRANSLATION[0x40000];
+
+static void translate_to_text(const MOS6502 *cpu, const uint16_t *entries,
+                              const size_t count) {
+  FILE *stream = tmpfile();
+  TEST_ASSERT_NOT_NULL(stream);
+
+  TEST_ASSERT_TRUE(mos6502_translate(cpu, entries, count, "probe", stream));
+  rewind(stream);
+
+  const size_t length =
+      fread(TRANSLATION, 1, sizeof(TRANSLATION) - 1, stream);
+  TRANSLATION[length] = '\0';
+
+  fclose(stream);
+}
+
+void test_translate_leaves_data_to_the_interpreter(void) {
+  const uint16_t entries[] = {0x0300, 0x030F};  // START and MESSAGE
+
+  hello_world_load(CPU);
+
+  translate_to_text(CPU, entries, 2);
+
+  TEST_ASSERT_NOT_NULL(strstr(TRANSLATION, "case 0x0300:"));
+  TEST_ASSERT_NULL(strstr(TRANSLATION, "case 0x030F:"));
+  TEST_ASSERT_NULL(strstr(TRANSLATION, "i_030F"));
+}
+
+void test_translate_leaves_banked_code_to_the_interpreter(void) {
+  static uint8_t image[2 * MOS6502_WINDOW_8K];
+  const uint16_t entries[] = {0x0300, 0x8000};  // START and SWITCH
+
+  mos6502_set_image(CPU, image, sizeof(image));
+  banks_load(CPU);
+
+  translate_to_text(CPU, entries, 2);
+
+  TEST_ASSERT_NOT_NULL(strstr(TRANSLATION, "case 0x0300:"));
+  TEST_ASSERT_NULL(strstr(TRANSLATION, "case 0x8000:"));
+  TEST_ASSERT_NOT_NULL(strstr(TRANSLATION, "this->PC = 0x8000;"));
+}
+
+/* LDA $3000,X; STA $2000; JMP back, with an IRQ handler that bumps X. */
+static void load_echo_program(MOS6502 *cpu) {
+  static const uint8_t PROGRAM[] = {0xBD, 0x00, 0x30, 0x8D, 0x00,
+                                    0x20, 0x4C, 0x00, 0x10};
+  static const uint8_t HANDLER[] = {0xE8, 0x4C, 0x00, 0x10};
+
+  memcpy(&cpu->BUS[0x1000], PROGRAM, sizeof(PROGRAM));
+  memcpy(&cpu->BUS[0x1100], HANDLER, sizeof(HANDLER));
+  cpu->BUS[MOS6502_VEC_IRQ] = 0x00;
+  cpu->BUS[MOS6502_VEC_IRQ + 1] = 0x11;
+  cpu->PC = 0x1000;
+
+  mos6502_add_port(cpu, 0x3000);
+  mos6502_add_port(cpu, 0x3001);
+}
+
+void test_mos6502_replay_reproduces_recorded_run(void) {
+  FILE *snapshot = tmpfile();
+  FILE *log = tmpfile();
+  TEST_ASSERT_NOT_NULL(snapshot);
+  TEST_ASSERT_NOT_NULL(log);
+
+  load_echo_program(CPU);
+  TEST_ASSERT_TRUE(mos6502_snapshot(CPU, snapshot));
+  mos6502_record(CPU, log);
+
+  mos6502_feed(CPU, 0x3000, 0x11);
+  mos6502_feed(CPU, 0x3000, 0x22);
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_WAITING, mos6502_run(CPU, 1000));
+
+  TEST_ASSERT_TRUE(mos6502_irq(CPU));
+  mos6502_feed(CPU, 0x3001, 0x33);
+  mos6502_feed(CPU, 0x3000, 0x44);
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_WAITING, mos6502_run(CPU, 1000));
+
+  mos6502_record(CPU, NULL);
+  TEST_ASSERT_EQUAL_UINT8(0x33, CPU->BUS[0x2000]);
+
+  MOS6502 *replayed = mos6502_construct();
+  TEST_ASSERT_NOT_NULL(replayed);
+  mos6502_add_port(replayed, 0x3000);
+  mos6502_add_port(replayed, 0x3001);
+
+  rewind(snapshot);
+  rewind(log);
+  TEST_ASSERT_TRUE(mos6502_restore(replayed, snapshot));
+  mos6502_replay(replayed, log);
+
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_STATE_WAITING, mos6502_run(replayed, 5000));
+  TEST_ASSERT_NULL(replayed->REPLAY);
+
+  TEST_ASSERT_EQUAL_UINT16(CPU->PC, replayed->PC);
+  TEST_ASSERT_EQUAL_UINT8(CPU->A, replayed->A);
+  TEST_ASSERT_EQUAL_UINT8(CPU->X, replayed->X);
+  TEST_ASSERT_EQUAL_UINT8(CPU->P, replayed->P);
+  TEST_ASSERT_EQUAL_UINT8(CPU->SP, replayed->SP);
+  TEST_ASSERT_EQUAL_UINT64(CPU->CYCLES, replayed->CYCLES);
+  TEST_ASSERT_EQUAL_MEMORY(CPU->BUS, replayed->BUS, MOS6502_BUS_SIZE);
+
+  mos6502_destruct(replayed);
+  fclose(snapshot);
+  fclose(log);
+}
+
+void test_mos6502_replay_reports_missed_interrupt(void) {
+  static const uint8_t LOOP[] = {0xE8, 0x4C, 0x00, 0x10};  // INX; JMP $1000
+  static const uint8_t JUMP[] = {0x4C, 0x00, 0x10};        // JMP $1000
+  FILE *snapshot = tmpfile();
+  FILE *log = tmpfile();
+  TEST_ASSERT_NOT_NULL(snapshot);
+  TEST_ASSERT_NOT_NULL(log);
+
+  load_echo_program(CPU);
+  memcpy(&CPU->BUS[0x1000], LOOP, sizeof(LOOP));
+  TEST_ASSERT_TRUE(mos6502_snapshot(CPU, snapshot));
+  mos6502_record(CPU, log);
+
+  // Instructions end on cycles 2 and 5, and the IRQ is taken on cycle 5
+  mos6502_run(CPU, 4);
+  TEST_ASSERT_EQUAL_UINT64(5, CPU->CYCLES);
+
+  const uint8_t sp = CPU->SP;
+
+  TEST_ASSERT_TRUE(mos6502_irq(CPU));
+  mos6502_record(CPU, NULL);
+
+  MOS6502 *replayed = mos6502_construct();
+  TEST_ASSERT_NOT_NULL(replayed);
+
+  rewind(snapshot);
+  rewind(log);
+  TEST_ASSERT_TRUE(mos6502_restore(replayed, snapshot));
+
+  // Only JMPs, which end on cycles 3 and 6, so cycle 5 is stepped over
+  memcpy(&replayed->BUS[0x1000], JUMP, sizeof(JUMP));
+  mos6502_replay(replayed, log);
+
+  mos6502_run(replayed, 20);
+
+  TEST_ASSERT_NULL(replayed->REPLAY);
+  TEST_ASSERT_EQUAL_UINT8(sp, replayed->SP);
+  TEST_ASSERT_EQUAL_UINT16(0x1000, replayed->PC);
+
+  mos6502_destruct(replayed);
+  fclose(snapshot);
+  fclose(log);
+}
+
+void test_mos6502_irq_masked_is_not_recorded(void) {
+  FILE *log = tmpfile();
+  TEST_ASSERT_NOT_NULL(log);
+
+  mos6502_record(CPU, log);
+  mos6502_set_status(CPU, MOS6502_STATUS_I);
+
+  TEST_ASSERT_FALSE(mos6502_irq(CPU));
+  TEST_ASSERT_EQUAL_INT(0, ftell(log));
+
+  mos6502_nmi(CPU);
+  TEST_ASSERT_EQUAL_INT(2, ftell(log));  // Kind and a zero cycle delta
+
+  fclose(log);
+}
+
+void test_mos6502_restore_rejects_foreign_data(void) {
+  FILE *stream = tmpfile();
+  TEST_ASSERT_NOT_NULL(stream);
+
+  fputs("not a snapshot", stream);
+  rewind(stream);
+
+  CPU->PC = 0x1234;
+
+  TEST_ASSERT_FALSE(mos6502_restore(CPU, stream));
+  TEST_ASSERT_EQUAL_UINT16(0x1234, CPU->PC);
+
+  fclose(stream);
+}
+
+void test_mos6502_restore_mismatch_leaves_cpu_untouched(void) {
+  FILE *stream = tmpfile();
+  TEST_ASSERT_NOT_NULL(stream);
+
+  MOS6502 *source = mos6502_construct();
+  TEST_ASSERT_NOT_NULL(source);
+
+  source->PC = 0x1111;
+  source->BUS[0x2000] = 0x55;
+  TEST_ASSERT_TRUE(mos6502_snapshot(source, stream));
+  mos6502_destruct(source);
+  rewind(stream);
+
+  memset(IMAGE, 0, sizeof(IMAGE));
+  mos6502_set_image(CPU, IMAGE, sizeof(IMAGE));
+  TEST_ASSERT_TRUE(mos6502_add_window(CPU, 0xA000, MOS6502_WINDOW_8K, 0xFFF0));
+  CPU->PC = 0x2222;
+  CPU->BUS[0x2000] = 0xAA;
+
+  TEST_ASSERT_FALSE(mos6502_restore(CPU, stream));
+  TEST_ASSERT_EQUAL_UINT16(0x2222, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT8(0xAA, CPU->BUS[0x2000]);
+
+  fclose(stream);
+}
+
+void test_mos6502_restore_truncated_leaves_cpu_untouched(void) {
+  FILE *stream = tmpfile();
+  FILE *truncated = tmpfile();
+  TEST_ASSERT_NOT_NULL(stream);
+  TEST_ASSERT_NOT_NULL(truncated);
+
+  CPU->PC = 0x1111;
+  CPU->BUS[0x2000] = 0x55;
+  TEST_ASSERT_TRUE(mos6502_snapshot(CPU, stream));
+  rewind(stream);
+
+  // Keep the registers and half of the bus
+  for (long index = 0; index < 0x8000; ++index) {
+    fputc(fgetc(stream), truncated);
+  }
+  rewind(truncated);
+
+  CPU->PC = 0x2222;
+  CPU->BUS[0x2000] = 0xAA;
+
+  TEST_ASSERT_FALSE(mos6502_restore(CPU, truncated));
+  TEST_ASSERT_EQUAL_UINT16(0x2222, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT8(0xAA, CPU->BUS[0x2000]);
+
+  fclose(stream);
+  fclose(truncated);
+}
+
+static void use_cache_directory(char *directory) {
+  TEST_ASSERT_NOT_NULL(mkdtemp(directory));
+  TEST_ASSERT_EQUAL_INT(0, setenv("MOS6502_CACHE", directory, 1));
+}
+
+static void remove_cache_directory(const char *directory, const uint64_t *keys,
+                                   const size_t count) {
+  char path[256];
+
+  mos6502_cache_close();
+
+  for (size_t index = 0; index < count; ++index) {
+    snprintf(path, sizeof(path), "%s/%016llx", directory,
+             (unsigned long long)keys[index]);
+    remove(path);
+  }
+
+  rmdir(directory);
+  unsetenv("MOS6502_CACHE");
+}
+
+void test_mos6502_cache_replays_recorded_fragment(void) {
+  char directory[] = "/tmp/mos6502-cache-XXXXXX";
+  const uint64_t key = 0x1234;
+
+  use_cache_directory(directory);
+
+  TEST_ASSERT_TRUE(mos6502_cache_begin(key));
+  mos6502_cache_write(0x0300, 0xA2);
+  mos6502_cache_write(0x0301, 0x00);
+  mos6502_cache_label(0x0302, "LOOP", 4);
+  mos6502_cache_reference(1, 0x0303, "DATA", 4);
+  TEST_ASSERT_TRUE(mos6502_cache_end(0x0305));
+
+  const uint8_t *ops = NULL;
+  size_t length = 0;
+  MOS6502_CacheOp op;
+
+  TEST_ASSERT_FALSE(mos6502_cache_lookup(0x4321, &ops, &length));
+  TEST_ASSERT_TRUE(mos6502_cache_lookup(key, &ops, &length));
+
+  const uint8_t *end = ops + length;
+
+  TEST_ASSERT_TRUE(mos6502_cache_next(&ops, end, &op));
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_CACHE_WRITE, op.kind);
+  TEST_ASSERT_EQUAL_UINT16(0x0300, op.address);
+  TEST_ASSERT_EQUAL_size_t(2, op.count);  // Contiguous bytes share one op
+  TEST_ASSERT_EQUAL_UINT8(0xA2, op.bytes[0]);
+
+  TEST_ASSERT_TRUE(mos6502_cache_next(&ops, end, &op));
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_CACHE_LABEL, op.kind);
+  TEST_ASSERT_EQUAL_UINT16(0x0302, op.address);
+  TEST_ASSERT_EQUAL_size_t(4, op.name_length);
+  TEST_ASSERT_EQUAL_MEMORY("LOOP", op.name, 4);
+
+  TEST_ASSERT_TRUE(mos6502_cache_next(&ops, end, &op));
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_CACHE_REFERENCE, op.kind);
+  TEST_ASSERT_EQUAL_UINT8(1, op.type);
+  TEST_ASSERT_EQUAL_UINT16(0x0303, op.address);
+  TEST_ASSERT_EQUAL_MEMORY("DATA", op.name, 4);
+
+  TEST_ASSERT_TRUE(mos6502_cache_next(&ops, end, &op));
+  TEST_ASSERT_EQUAL_UINT8(MOS6502_CACHE_END, op.kind);
+  TEST_ASSERT_EQUAL_UINT16(0x0305, op.address);
+
+  TEST_ASSERT_FALSE(mos6502_cache_next(&ops, end, &op));
+
+  remove_cache_directory(directory, &key, 1);
+}
+
+void test_mos6502_cache_nested_fragments_are_self_contained(void) {
+  char directory[] = "/tmp/mos6502-cache-XXXXXX";
+  const uint64_t keys[2] = {1, 2};
+
+  use_cache_directory(directory);
+
+  TEST_ASSERT_TRUE(mos6502_cache_begin(keys[0]));
+  mos6502_cache_write(0x0300, 0xE8);
+  TEST_ASSERT_TRUE(mos6502_cache_begin(keys[1]));
+  mos6502_cache_write(0x0301, 0xE8);
+  TEST_ASSERT_TRUE(mos6502_cache_end(0x0302));
+  mos6502_cache_write(0x0302, 0x00);
+  TEST_ASSERT_TRUE(mos6502_cache_end(0x0303));
+
+  const uint8_t *ops = NULL;
+  size_t length = 0;
+  MOS6502_CacheOp op;
+
+  TEST_ASSERT_TRUE(mos6502_cache_lookup(keys[1], &ops, &length));
+  TEST_ASSERT_TRUE(mos6502_cache_next(&ops, ops + length, &op));
+  TEST_ASSERT_EQUAL_UINT16(0x0301, op.address);
+  TEST_ASSERT_EQUAL_size_t(1, op.count);
+
+  TEST_ASSERT_TRUE(mos6502_cache_lookup(keys[0], &ops, &length));
+  TEST_ASSERT_TRUE(mos6502_cache_next(&ops, ops + length, &op));
+  TEST_ASSERT_EQUAL_UINT16(0x0300, op.address);
+  TEST_ASSERT_EQUAL_size_t(3, op.count);
+
+  remove_cache_directory(directory, keys, 2);
+}
+
+void test_mos6502_cache_changed_dependency_misses(void) {
+  char directory[] = "/tmp/mos6502-cache-XXXXXX";
+  const uint64_t keys[2] = {1, 2};
+  char source[64];
+
+  use_cache_directory(directory);
+  snprintf(source, sizeof(source), "%s/lib.asm", directory);
+
+  FILE *stream = fopen(source, "w");
+  TEST_ASSERT_NOT_NULL(stream);
+  fputs("    INX\n", stream);
+  fclose(stream);
+
+  TEST_ASSERT_TRUE(mos6502_cache_begin(keys[0]));
+  mos6502_cache_depend(source,
+                       mos6502_cache_hash(MOS6502_CACHE_SEED, "    INX\n", 8));
+  mos6502_cache_write(0x0300, 0xE8);
+  TEST_ASSERT_TRUE(mos6502_cache_end(0x0301));
+
+  const uint8_t *ops = NULL;
+  size_t length = 0;
+
+  // A hit while recording carries the dependency over to the outer fragment
+  TEST_ASSERT_TRUE(mos6502_cache_begin(keys[1]));
+  TEST_ASSERT_TRUE(mos6502_cache_lookup(keys[0], &ops, &length));
+  TEST_ASSERT_TRUE(mos6502_cache_end(0x0301));
+  TEST_ASSERT_TRUE(mos6502_cache_lookup(keys[1], &ops, &length));
+
+  stream = fopen(source, "w");
+  TEST_ASSERT_NOT_NULL(stream);
+  fputs("    INY\n", stream);
+  fclose(stream);
+
+  TEST_ASSERT_FALSE(mos6502_cache_lookup(keys[0], &ops, &length));
+  TEST_ASSERT_FALSE(mos6502_cache_lookup(keys[1], &ops, &length));
+
+  remove(source);
+  remove_cache_directory(directory, keys, 2);
+}
+
+void test_mos6502_cache_corrupt_fragment_misses(void) {
+  char directory[] = "/tmp/mos6502-cache-XXXXXX";
+  const uint64_t keys[2] = {1, 2};
+  char path[64];
+
+  use_cache_directory(directory);
+
+  TEST_ASSERT_TRUE(mos6502_cache_begin(keys[0]));
+  mos6502_cache_write(0x0300, 0xE8);
+  TEST_ASSERT_TRUE(mos6502_cache_end(0x0301));
+
+  // Same header and ops length, but the ops are not a stream ending in END
+  snprintf(path, sizeof(path), "%s/%016llx", directory,
+           (unsigned long long)keys[0]);
+  FILE *stream = fopen(path, "r+b");
+  TEST_ASSERT_NOT_NULL(stream);
+  TEST_ASSERT_EQUAL_INT(0, fseek(stream, -3, SEEK_END));
+  fputc(0xFF, stream);
+  fclose(stream);
+
+  // An op that claims more bytes than the fragment holds
+  TEST_ASSERT_TRUE(mos6502_cache_begin(keys[1]));
+  mos6502_cache_label(0x0300, "LOOP", 4);
+  TEST_ASSERT_TRUE(mos6502_cache_end(0x0300));
+
+  snprintf(path, sizeof(path), "%s/%016llx", directory,
+           (unsigned long long)keys[1]);
+  stream = fopen(path, "r+b");
+  TEST_ASSERT_NOT_NULL(stream);
+  TEST_ASSERT_EQUAL_INT(0, fseek(stream, -(3 + 4 + 2), SEEK_END));
+  fputc(0xFF, stream);
+  fclose(stream);
+
+  const uint8_t *ops = NULL;
+  size_t length = 0;
+
+  TEST_ASSERT_FALSE(mos6502_cache_lookup(keys[0], &ops, &length));
+  TEST_ASSERT_FALSE(mos6502_cache_lookup(keys[1], &ops, &length));
+
+  remove_cache_directory(directory, keys, 2);
+}
+
+#define ARITHMETIC_FLAGS                                                       \
+  (MOS6502_STATUS_C | MOS6502_STATUS_Z | MOS6502_STATUS_V | MOS6502_STATUS_N)
+
+/* Reference arithmetic, digit by digit, packed as flags << 8 | result. */
+static uint16_t reference_binary_adc(const uint8_t a, const uint8_t operand,
+                                     const uint8_t carry) {
+  const unsigned sum = a + operand + carry;
+  const uint8_t result = (uint8_t)sum;
+  uint8_t flags = result & MOS6502_STATUS_N;
+
+  if (0xFF < sum) {
+    flags |= MOS6502_STATUS_C;
+  }
+  if (0 == result) {
+    flags |= MOS6502_STATUS_Z;
+  }
+  if (!((a ^ operand) & 0x80) && ((a ^ result) & 0x80)) {
+    flags |= MOS6502_STATUS_V;
+  }
+
+  return (uint16_t)((flags << 8) | result);
+}
+
+static uint16_t reference_binary_sbc(const uint8_t a, const uint8_t operand,
+                                     const uint8_t carry) {
+  return reference_binary_adc(a, (uint8_t)~operand, carry);
+}
+
+static uint16_t reference_decimal_adc(const uint8_t a, const uint8_t operand,
+                                      const uint8_t carry) {
+  unsigned sum = (a & 0x0F) + (operand & 0x0F) + carry;
+
+  if (9 < sum) {
+    sum += 6;
+  }
+
+  if (sum <= 0x0F) {
+    sum = (sum & 0x0F) + (a & 0xF0) + (operand & 0xF0);
+  } else {
+    sum = (sum & 0x0F) + (a & 0xF0) + (operand & 0xF0) + 0x10;
+  }
+
+  // Z comes from the binary sum, N and V from the unadjusted high digit
+  uint8_t flags = (uint8_t)(reference_binary_adc(a, operand, carry) >> 8) &
+                  MOS6502_STATUS_Z;
+
+  if (sum & 0x80) {
+    flags |= MOS6502_STATUS_N;
+  }
+  if (((a ^ sum) & 0x80) && !((a ^ operand) & 0x80)) {
+    flags |= MOS6502_STATUS_V;
+  }
+  if (0x90 < (sum & 0x1F0)) {
+    sum += 0x60;
+  }
+  if (0xF0 < (sum & 0xFF0)) {
+    flags |= MOS6502_STATUS_C;
+  }
+
+  return (uint16_t)((flags << 8) | (sum & 0xFF));
+}
+
+static uint16_t reference_decimal_sbc(const uint8_t a, const uint8_t operand,
+                                      const uint8_t carry) {
+  unsigned difference = (a & 0x0F) - (operand & 0x0F) - (carry ? 0 : 1);
+
+  if (difference & 0x10) {
+    difference = ((difference - 6) & 0x0F) |
+                 ((a & 0xF0) - (operand & 0xF0) - 0x10);
+  } else {
+    difference = (difference & 0x0F) | ((a & 0xF0) - (operand & 0xF0));
+  }
+
+  if (difference & 0x100) {
+    difference -= 0x60;
+  }
+
+  // Flags are those of the binary subtraction
+  const uint16_t binary = reference_binary_sbc(a, operand, carry);
+
+  return (uint16_t)((binary & 0xFF00) | (difference & 0xFF));
+}
+
+static void assert_arithmetic(void (*operation)(MOS6502 *, const uint8_t),
+                              uint16_t (*reference)(const uint8_t,
+                                                    const uint8_t,
+                                                    const uint8_t),
+                              const uint8_t decimal) {
+  for (uint64_t index = 0; index < 2 * 256 * 256; ++index) {
+    const uint8_t carry = (uint8_t)(index >> 16);
+    const uint8_t a = (uint8_t)(index >> 8);
+    const uint8_t operand = (uint8_t)index;
+
+    CPU->A = a;
+    CPU->P = MOS6502_STATUS_I | decimal | carry;
+
+    operation(CPU, operand);
+
+    const uint16_t actual =
+        (uint16_t)(((CPU->P & ARITHMETIC_FLAGS) << 8) | CPU->A);
+
+    // The inputs ride along in the upper bits so a failure names them
+    TEST_ASSERT_EQUAL_UINT64((index << 16) | reference(a, operand, carry),
+                             (index << 16) | actual);
+    TEST_ASSERT_EQUAL_UINT8(MOS6502_STATUS_I | decimal,
+                            CPU->P & ~ARITHMETIC_FLAGS);
+  }
+}
+
+void test_mos6502_adc_sbc_binary_exhaustive(void) {
+  assert_arithmetic(mos6502_adc, reference_binary_adc, 0);
+  assert_arithmetic(mos6502_sbc, reference_binary_sbc, 0);
+}
+
+void test_mos6502_adc_sbc_decimal_exhaustive(void) {
+  assert_arithmetic(mos6502_adc, reference_decimal_adc, MOS6502_STATUS_D);
+  assert_arithmetic(mos6502_sbc, reference_decimal_sbc, MOS6502_STATUS_D);
+}
+
+void test_mos6502_execute_decimal_ADC_SBC(void) {
+  const uint8_t program[] = {
+      MOS6502_SED_IMPLIED_MODE, MOS6502_CLC_IMPLIED_MODE,
+      MOS6502_ADC_IMMEDIATE_MODE, 0x46,
+      MOS6502_SEC_IMPLIED_MODE, MOS6502_SBC_IMMEDIATE_MODE, 0x05,
+      MOS6502_CLD_IMPLIED_MODE,
+  };
+
+  memcpy(&CPU->BUS[0x0300], program, sizeof(program));
+  CPU->PC = 0x0300;
+  CPU->A = 0x58;
+
+  mos6502_run(CPU, 8);  // SED, CLC, ADC, SEC
+
+  TEST_ASSERT_EQUAL_UINT8(0x04, CPU->A);  // 58 + 46 = 104
+
+  mos6502_run(CPU, 4);  // SBC, CLD
+
+  TEST_ASSERT_EQUAL_UINT8(0x99, CPU->A);  // 04 - 05 = -1, borrowing
+  TEST_ASSERT_FALSE(mos6502_get_status(CPU, MOS6502_STATUS_C));
+  TEST_ASSERT_FALSE(mos6502_get_status(CPU, MOS6502_STATUS_D));
+  TEST_ASSERT_EQUAL_UINT16(0x0308, CPU->PC);
+  TEST_ASSERT_EQUAL_UINT64(12, CPU->CYCLES);
+}
+
 static const test_t TESTS[] = {
     test_mos6502_read_write,
     test_mos6502_set_get_clear_status,
@@ -353,6 +1578,50 @@ static const test_t TESTS[] = {
     test_mos6502_execute_INX_IMPLIED,
     test_mos6502_execute_JMP_ABSOLUTE,
     test_mos6502_execute_BRK_IMPLIED,
+    test_mos6502_breakpoint_pauses_and_resumes,
+    test_mos6502_write_watchpoint_calls_handler,
+    test_mos6502_stack_watchpoints_call_handler,
+    test_mos6502_read_watchpoint_ignores_other_addresses,
+    test_mos6502_read_watchpoint_on_code_makes_progress,
+    test_mos6502_remove_trap_clears_page_flags,
+    test_mos6502_run_counts_cycles,
+    test_mos6502_port_read_waits_and_restarts,
+    test_mos6502_port_read_keeps_watchpoint_pause,
+    test_mos6502_resume_without_input_keeps_waiting,
+    test_mos6502_brk_does_not_wait_on_vector_port,
+    test_mos6502_feed_rejects_unknown_or_full_port,
+    test_mos6502_scheduler_skips_waiting_cpus,
+    test_mos6502_add_window_rejects_bad_geometry,
+    test_mos6502_windows_start_on_their_own_banks,
+    test_mos6502_add_window_needs_room_for_its_bank,
+    test_mos6502_control_register_switches_bank,
+    test_mos6502_select_bank_outside_image_fails,
+    test_assembler_places_banks_in_the_image,
+    test_assembler_lexes_every_keyword,
+    test_assembler_accepts_an_empty_file,
+    test_mos6502_dump_shows_mapped_bank,
+    test_aot_matches_interpreter,
+    test_aot_honours_breakpoints,
+    test_aot_honours_read_watchpoints_on_code,
+    test_aot_resume_does_not_skip_next_breakpoint,
+    test_macro_directives_accept_comments,
+    test_aot_trap_handler_sees_instruction_pc,
+    test_translate_leaves_data_to_the_interpreter,
+    test_aot_follows_bank_switch_under_code,
+    test_translate_leaves_banked_code_to_the_interpreter,
+    test_mos6502_replay_reproduces_recorded_run,
+    test_mos6502_replay_reports_missed_interrupt,
+    test_mos6502_irq_masked_is_not_recorded,
+    test_mos6502_restore_rejects_foreign_data,
+    test_mos6502_restore_mismatch_leaves_cpu_untouched,
+    test_mos6502_restore_truncated_leaves_cpu_untouched,
+    test_mos6502_cache_replays_recorded_fragment,
+    test_mos6502_cache_nested_fragments_are_self_contained,
+    test_mos6502_cache_changed_dependency_misses,
+    test_mos6502_cache_corrupt_fragment_misses,
+    test_mos6502_adc_sbc_binary_exhaustive,
+    test_mos6502_adc_sbc_decimal_exhaustive,
+    test_mos6502_execute_decimal_ADC_SBC,
 };
 
 int main(void) {
@@ -0,0 +1,21 @@
+// Two windows over one image and code assembled into chosen banks,
+// translated at build time
+.WINDOW $8000, $2000, $FFF0
+.WINDOW $A000, $2000, $FFF1
+
+.BANK 2
+.ORG $8000
+    .BYTE "TWO"
+
+.BANK 3
+.ORG $A000
+    .BYTE "THREE"
+
+.BANK 4
+.ORG $A000
+    .BYTE "FOUR"
+
+.ORG $0300
+
+START:
+    BRK